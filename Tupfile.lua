@@ -1,2 +1,10 @@
 GTKObjects = Define.Objects{ Sources = Item '*.cxx' }
 
+-- Headless drawing throughput, run as ./benchmark [results.json]
+Define.Executable
+{
+	Name = 'benchmark',
+	Sources = Item 'benchmark/benchmark.cxx',
+	Objects = GTKObjects,
+	LinkFlags = '-pthread'
+}
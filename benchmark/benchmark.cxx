@@ -0,0 +1,215 @@
+#include "../gtkcairowrapper.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+// Headless drawing throughput, written as JSON to the file named by the first argument or stdout.
+
+const unsigned int FormatVersion = 1;
+const double MinimumSeconds = 0.5; // Per measurement
+const FlatVector CanvasSize(1024, 768);
+
+struct Result
+{
+	String Name, Unit;
+	double Value;
+};
+
+typedef std::function<void(Slate &Canvas, unsigned int Index)> Operation;
+
+// Deterministic scatter so runs are comparable
+static FlatVector Scatter(unsigned int Index, FlatVector const &Size = CanvasSize)
+	{ return FlatVector((Index * 7919) % (unsigned int)Size[0], (Index * 104729) % (unsigned int)Size[1]); }
+
+// Returns seconds per render
+static double TimeRenders(Slate &Canvas, FlatVector const &Size)
+{
+	cairo_surface_t *Target = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, Size[0], Size[1]);
+	Canvas.RenderTo(Target, Size); // Warms the caches
+
+	unsigned int Renders = 0;
+	double Elapsed = 0;
+	auto const Start = std::chrono::steady_clock::now();
+	do
+	{
+		Canvas.RenderTo(Target, Size);
+		++Renders;
+		Elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+	} while (Elapsed < MinimumSeconds);
+
+	cairo_surface_destroy(Target);
+	return Elapsed / Renders;
+}
+
+static Result Throughput(Slate &Canvas, String const &Name, unsigned int Count, Operation const &Draw)
+{
+	Canvas.SetDrawHandler([&Canvas, Count, &Draw](void)
+	{
+		Canvas.SetColor(Color(0, 0, 0, 1));
+		for (unsigned int Index = 0; Index < Count; ++Index) Draw(Canvas, Index);
+	});
+	return Result{Name, "operations/s", Count / TimeRenders(Canvas, CanvasSize)};
+}
+
+static Result Throughput(String const &Name, unsigned int Count, Operation const &Draw)
+{
+	Slate Canvas(CanvasSize);
+	return Throughput(Canvas, Name, Count, Draw);
+}
+
+static void DrawScene(Slate &Canvas, FlatVector const &Size)
+{
+	Canvas.SetColor(Color(0.5f, 0.5f, 0.5f, 1));
+	Canvas.SetWidth(1);
+	for (float X = 0; X < Size[0]; X += 32) Canvas.DrawLine(FlatVector(X, 0), FlatVector(X, Size[1]));
+	for (float Y = 0; Y < Size[1]; Y += 32) Canvas.DrawLine(FlatVector(0, Y), FlatVector(Size[0], Y));
+
+	Canvas.SetColor(Color(0.2f, 0.4f, 0.8f, 1));
+	Canvas.SetFill(true);
+	for (unsigned int Index = 0; Index < 500; ++Index)
+		Canvas.DrawRoundedRectangle(Scatter(Index, Size), FlatVector(40, 24));
+	Canvas.SetFill(false);
+	Canvas.SetWidth(2);
+	for (unsigned int Index = 0; Index < 500; ++Index)
+		Canvas.DrawCircle(Scatter(Index + 500, Size), 8);
+
+	Canvas.SetColor(Color(0, 0, 0, 1));
+	for (unsigned int Index = 0; Index < 200; ++Index)
+		Canvas.Print("Label", taLeft, Scatter(Index + 1000, Size));
+}
+
+static void Write(std::ostream &Out, std::vector<Result> const &Results)
+{
+	Out << "{\n\t\"version\": " << FormatVersion << ",\n\t\"results\":\n\t[\n";
+	for (unsigned int Index = 0; Index < Results.size(); ++Index)
+		Out << "\t\t{\"name\": \"" << Results[Index].Name << "\", \"unit\": \"" << Results[Index].Unit <<
+			"\", \"value\": " << Results[Index].Value << "}" << (Index + 1 < Results.size() ? "," : "") << "\n";
+	Out << "\t]\n}\n";
+}
+
+int main(int ArgumentCount, char **Arguments)
+{
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+	g_type_init();
+#endif
+
+	std::vector<Result> Results;
+
+	// Primitives
+	Results.push_back(Throughput("DrawLine", 10000, [](Slate &Canvas, unsigned int Index)
+		{ Canvas.DrawLine(Scatter(Index), Scatter(Index + 1)); }));
+	Results.push_back(Throughput("DrawRectangle", 10000, [](Slate &Canvas, unsigned int Index)
+		{ Canvas.DrawRectangle(Scatter(Index), FlatVector(20, 10)); }));
+	Results.push_back(Throughput("DrawRectangleFilled", 10000, [](Slate &Canvas, unsigned int Index)
+		{ Canvas.SetFill(true); Canvas.DrawRectangle(Scatter(Index), FlatVector(20, 10)); }));
+	Results.push_back(Throughput("DrawRoundedRectangle", 10000, [](Slate &Canvas, unsigned int Index)
+		{ Canvas.DrawRoundedRectangle(Scatter(Index), FlatVector(20, 10)); }));
+	Results.push_back(Throughput("DrawCircle", 10000, [](Slate &Canvas, unsigned int Index)
+		{ Canvas.DrawCircle(Scatter(Index), 5); }));
+	Results.push_back(Throughput("DrawArc", 10000, [](Slate &Canvas, unsigned int Index)
+		{ Canvas.DrawArc(Scatter(Index), 5, 0, 90); }));
+
+	std::vector<FlatVector> Points;
+	for (unsigned int Index = 0; Index < 10000; ++Index) Points.push_back(Scatter(Index));
+	Results.push_back(Throughput("DrawLines", 1, [&Points](Slate &Canvas, unsigned int)
+		{ Canvas.DrawLines(&Points[0], Points.size() / 2); }));
+	Results.back().Value *= Points.size() / 2;
+	Results.push_back(Throughput("DrawCircles", 1, [&Points](Slate &Canvas, unsigned int)
+		{ Canvas.DrawCircles(&Points[0], Points.size(), 5); }));
+	Results.back().Value *= Points.size();
+
+	{
+		std::vector<float> Samples(5000000);
+		for (unsigned int Index = 0; Index < Samples.size(); ++Index) Samples[Index] = sinf(Index * 0.001f) + (Index * 7919 % 1000) / 5000.0f;
+		Results.push_back(Throughput("DrawSeries", 1, [&Samples](Slate &Canvas, unsigned int)
+		{
+			Canvas.DrawSeries(&Samples[0], Samples.size(), RangeF(0, Samples.size() - 1), RangeF(-1.5f, 1.5f),
+				Region(FlatVector(0, 0), CanvasSize));
+		}));
+		Results.back().Unit = "megasamples/s";
+		Results.back().Value *= Samples.size() / 1000000.0;
+	}
+
+	// Text
+	Results.push_back(Throughput("VectorArea::Print", 2000, [](Slate &Canvas, unsigned int Index)
+		{ Canvas.Print("Benchmark text", taLeft, Scatter(Index)); }));
+	{
+		Slate Canvas(CanvasSize);
+		Font *Label = Canvas.GetFont(12);
+		Results.push_back(Throughput(Canvas, "FontData::Print", 2000, [Label](Slate &, unsigned int Index)
+			{ (*Label)->Print("Benchmark text", taLeft, Scatter(Index)); }));
+		delete Label;
+	}
+	{
+		std::shared_ptr<GlyphAtlas const> const Atlas = std::make_shared<GlyphAtlas const>();
+		Results.push_back(Throughput("DrawHexGlyphs", 10000, [&Atlas](Slate &Canvas, unsigned int Index)
+			{ Canvas.DrawHexGlyphs(Atlas, Scatter(Index), Index, 8); }));
+	}
+
+	// Images
+	gchar *ImagePath = g_build_filename(g_get_tmp_dir(), "ren-gtk-benchmark.png", nullptr);
+	String const ImageFilename = ImagePath;
+	g_free(ImagePath);
+	{
+		cairo_surface_t *Image = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 64, 64);
+		cairo_t *Context = cairo_create(Image);
+		cairo_set_source_rgba(Context, 0.8, 0.2, 0.2, 0.75);
+		cairo_paint(Context);
+		cairo_destroy(Context);
+		cairo_surface_write_to_png(Image, ImageFilename.c_str());
+		cairo_surface_destroy(Image);
+	}
+	Results.push_back(Throughput("DrawImage", 2000, [&ImageFilename](Slate &Canvas, unsigned int Index)
+		{ Canvas.DrawImage(ImageFilename, Scatter(Index), false); }));
+	Results.push_back(Throughput("DrawImageRotated", 2000, [&ImageFilename](Slate &Canvas, unsigned int Index)
+		{ Canvas.DrawImage(ImageFilename, Scatter(Index), Angle(Index)); }));
+	remove(ImageFilename.c_str());
+
+	// Pixel buffers, converted and scaled to the whole canvas
+	{
+		unsigned int const Width = 512, Height = 512;
+		std::vector<uint8_t> Bytes(Width * Height * 4);
+		for (unsigned int Index = 0; Index < Bytes.size(); ++Index) Bytes[Index] = Index * 31;
+		std::vector<float> Floats(Width * Height);
+		for (unsigned int Index = 0; Index < Floats.size(); ++Index) Floats[Index] = (Index % 977) / 977.0f;
+		Region const Target(FlatVector(0, 0), CanvasSize);
+
+		Results.push_back(Throughput("DrawPixelsRGBA8", 1, [&](Slate &Canvas, unsigned int)
+			{ Canvas.DrawPixels(&Bytes[0], pfRGBA8, Width, Height, Width * 4, Target); }));
+		Results.back().Unit = "megapixels/s";
+		Results.back().Value *= Width * Height / 1000000.0;
+		Results.push_back(Throughput("DrawPixelsGrayFloat", 1, [&](Slate &Canvas, unsigned int)
+			{ Canvas.DrawPixels(&Floats[0], pfGrayFloat, Width, Height, Width * sizeof(float), Target); }));
+		Results.back().Unit = "megapixels/s";
+		Results.back().Value *= Width * Height / 1000000.0;
+	}
+
+	// Full redraws
+	FlatVector const Sizes[] = {FlatVector(640, 480), FlatVector(1920, 1080), FlatVector(3840, 2160)};
+	for (auto &Size : Sizes)
+	{
+		Slate Canvas(Size);
+		Canvas.SetDrawHandler([&Canvas, &Size](void) { DrawScene(Canvas, Size); });
+		MemoryStream Name;
+		Name << "SlateRedraw" << (int)Size[0] << "x" << (int)Size[1];
+		Results.push_back(Result{Name, "ms", TimeRenders(Canvas, Size) * 1000});
+	}
+
+	if (ArgumentCount > 1)
+	{
+		std::ofstream Out(Arguments[1]);
+		if (!Out)
+		{
+			std::cerr << "Couldn't open " << Arguments[1] << " for writing." << std::endl;
+			return 1;
+		}
+		Write(Out, Results);
+	}
+	else Write(std::cout, Results);
+	return 0;
+}
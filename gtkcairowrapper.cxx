@@ -1,73 +1,763 @@
 #include "gtkcairowrapper.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cmath>
 #include <iostream>
+#include <mutex>
+#include <sys/stat.h>
+#include <cairo-svg.h>
+#include <cairo-pdf.h>
+#include <cstdint>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+const size_t DefaultImageCacheBudget = 32 * 1024 * 1024;
+
+ImageCache::ImageCache(void) :
+	Images(DefaultImageCacheBudget, [](Image &Releasee) { if (Releasee.Surface != nullptr) cairo_surface_destroy(Releasee.Surface); }),
+	Hits(0), Misses(0)
+	{}
+
+ImageCache &ImageCache::Instance(void)
+{
+	static ImageCache Out;
+	return Out;
+}
+
+void ImageCache::SetBudget(size_t Bytes)
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	Images.SetBudget(Bytes);
+}
+
+void ImageCache::Clear(void)
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	Images.Clear();
+}
+
+ImageCache::Statistics ImageCache::GetStatistics(void) const
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	Statistics Out;
+	Out.Hits = Hits;
+	Out.Misses = Misses;
+	Out.Evictions = Images.GetEvictions();
+	Out.Bytes = Images.GetCost();
+	Out.Budget = Images.GetBudget();
+	Out.Count = Images.Count();
+	return Out;
+}
+
+void ImageCache::ResetStatistics(void)
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	Hits = 0;
+	Misses = 0;
+	Images.ResetEvictions();
+}
+
+const size_t FailedImageCost = 64; // Failures are remembered, but shouldn't crowd out images
+
+static bool IsCurrent(struct stat const &FileStatus, time_t Modified, long ModifiedNanoseconds, long long Size)
+{
+	return (FileStatus.st_mtime == Modified) && (FileStatus.st_mtim.tv_nsec == ModifiedNanoseconds) &&
+		(FileStatus.st_size == Size);
+}
+
+cairo_surface_t *ImageCache::Load(String const &Filename)
+{
+	struct stat FileStatus;
+	if (stat(Filename.c_str(), &FileStatus) != 0)
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		Images.Remove(Filename);
+		return nullptr;
+	}
+
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		Image *Found = Images.Find(Filename);
+		if ((Found != nullptr) && IsCurrent(FileStatus, Found->Modified, Found->ModifiedNanoseconds, Found->Size))
+		{
+			++Hits;
+			return (Found->Surface == nullptr) ? nullptr : cairo_surface_reference(Found->Surface);
+		}
+		++Misses;
+	}
+
+	// Decoded unlocked so other loads and lookups don't wait on it
+	cairo_surface_t *Surface = cairo_image_surface_create_from_png(Filename.c_str());
+	if (cairo_surface_status(Surface) != CAIRO_STATUS_SUCCESS)
+	{
+		cairo_surface_destroy(Surface);
+		Surface = nullptr;
+	}
+
+	std::lock_guard<std::mutex> Lock(Mutex);
+	Image *Found = Images.Find(Filename);
+	if ((Found != nullptr) && IsCurrent(FileStatus, Found->Modified, Found->ModifiedNanoseconds, Found->Size))
+	{
+		// Another thread decoded the same version meanwhile
+		if (Surface != nullptr) cairo_surface_destroy(Surface);
+		return (Found->Surface == nullptr) ? nullptr : cairo_surface_reference(Found->Surface);
+	}
+	if (Surface == nullptr)
+	{
+		Images.Add(Filename, Image{nullptr, FileStatus.st_mtime, FileStatus.st_mtim.tv_nsec, FileStatus.st_size}, 
+			FailedImageCost);
+		return nullptr;
+	}
+	Images.Add(Filename, Image{Surface, FileStatus.st_mtime, FileStatus.st_mtim.tv_nsec, FileStatus.st_size},
+		cairo_image_surface_get_stride(Surface) * cairo_image_surface_get_height(Surface));
+	return cairo_surface_reference(Surface);
+}
+
+cairo_surface_t *ImageCache::Find(String const &Filename)
+{
+	struct stat FileStatus;
+	if (stat(Filename.c_str(), &FileStatus) != 0) return nullptr;
+
+	std::lock_guard<std::mutex> Lock(Mutex);
+	Image *Found = Images.Find(Filename);
+	if ((Found == nullptr) || (Found->Surface == nullptr) ||
+		!IsCurrent(FileStatus, Found->Modified, Found->ModifiedNanoseconds, Found->Size)) 
+		return nullptr;
+	++Hits;
+	return cairo_surface_reference(Found->Surface);
+}
+
+// Hit testing
+SpatialIndex::SpatialIndex(float CellSize) : CellSize(CellSize), NextOrder(0)
+	{ assert(CellSize > 0); }
+
+template <typename CellHandler> void SpatialIndex::ForCells(Region const &Area, CellHandler const &Handler) const
+{
+	int const Left = (int)floorf(Area.Start[0] / CellSize), Top = (int)floorf(Area.Start[1] / CellSize),
+		Right = (int)floorf((Area.Start[0] + Area.Size[0]) / CellSize),
+		Bottom = (int)floorf((Area.Start[1] + Area.Size[1]) / CellSize);
+	for (int Y = Top; Y <= Bottom; ++Y)
+		for (int X = Left; X <= Right; ++X)
+			Handler(Cell(X, Y));
+}
+
+void SpatialIndex::Add(ShapeID ID, Region const &Bounds)
+{
+	Remove(ID);
+	Shapes[ID] = Shape{Bounds, NextOrder++};
+	ForCells(Bounds, [this, ID](Cell const &Key) { Cells[Key].push_back(ID); });
+}
+
+void SpatialIndex::Remove(ShapeID ID)
+{
+	auto Found = Shapes.find(ID);
+	if (Found == Shapes.end()) return;
+	ForCells(Found->second.Bounds, [this, ID](Cell const &Key)
+	{
+		auto Members = Cells.find(Key);
+		Members->second.erase(std::find(Members->second.begin(), Members->second.end(), ID));
+		if (Members->second.empty()) Cells.erase(Members);
+	});
+	Shapes.erase(Found);
+}
+
+void SpatialIndex::Clear(void)
+{
+	Shapes.clear();
+	Cells.clear();
+	NextOrder = 0;
+}
+
+unsigned int SpatialIndex::Count(void) const
+	{ return Shapes.size(); }
 
-FontData::FontData(const std::pair<int, VectorArea *> &Data) :
-	PangoFont(pango_font_description_new()), Canvas(Data.second)
+std::vector<SpatialIndex::ShapeID> SpatialIndex::Find(FlatVector const &Point) const
 {
-	pango_font_description_set_family(PangoFont, "sans");
-	pango_font_description_set_absolute_size(PangoFont, Data.first * PANGO_SCALE);
+	std::vector<ShapeID> Hits;
+	auto Members = Cells.find(Cell((int)floorf(Point[0] / CellSize), (int)floorf(Point[1] / CellSize)));
+	if (Members == Cells.end()) return Hits;
+	for (auto ID : Members->second)
+	{
+		Region const &Bounds = Shapes.find(ID)->second.Bounds;
+		if ((Point[0] >= Bounds.Start[0]) && (Point[0] < Bounds.Start[0] + Bounds.Size[0]) &&
+			(Point[1] >= Bounds.Start[1]) && (Point[1] < Bounds.Start[1] + Bounds.Size[1]))
+			Hits.push_back(ID);
+	}
+	return Sort(Hits);
+}
+
+std::vector<SpatialIndex::ShapeID> SpatialIndex::Find(Region const &Area) const
+{
+	std::vector<ShapeID> Hits;
+	ForCells(Area, [this, &Area, &Hits](Cell const &Key)
+	{
+		auto Members = Cells.find(Key);
+		if (Members == Cells.end()) return;
+		for (auto ID : Members->second)
+		{
+			Region const &Bounds = Shapes.find(ID)->second.Bounds;
+			if ((Bounds.Start[0] < Area.Start[0] + Area.Size[0]) && (Area.Start[0] < Bounds.Start[0] + Bounds.Size[0]) &&
+				(Bounds.Start[1] < Area.Start[1] + Area.Size[1]) && (Area.Start[1] < Bounds.Start[1] + Bounds.Size[1]))
+				Hits.push_back(ID);
+		}
+	});
+	// Shapes spanning several cells are found more than once
+	std::sort(Hits.begin(), Hits.end());
+	Hits.erase(std::unique(Hits.begin(), Hits.end()), Hits.end());
+	return Sort(Hits);
+}
+
+std::vector<SpatialIndex::ShapeID> SpatialIndex::Sort(std::vector<ShapeID> &Hits) const
+{
+	std::sort(Hits.begin(), Hits.end(), [this](ShapeID First, ShapeID Second)
+		{ return Shapes.find(First)->second.Order > Shapes.find(Second)->second.Order; });
+	return Hits;
+}
+
+// Retained drawing
+struct DrawCommand
+{
+	enum CommandType
+	{
+		// State, always replayed
+		dcTranslate, dcColor, dcWidth, dcCap, dcFontSize,
+		// Primitives, replayed if the bounds intersect the damage
+		dcLine, dcRectangle, dcStamp, dcCircle, dcArc,
+		dcLines, dcPolyline, dcRectangles, dcCircles,
+		dcText, dcImage, dcRotatedImage, dcFontText, dcFontBoxText, dcGlyphs, dcPixels
+	} Type;
+	bool Flag; // Fill for shapes, rounded for caps, wrap for boxed text
+	int Option; // Alignment for boxed text
+	unsigned int Text, Font, Points, Stamp, Atlas, Surface; // Indices into the DisplayList tables
+	unsigned int Count; // Number of points for batches
+	float Bounds[4]; // Device space left, top, right, bottom
+	float Arguments[6];
+
+	DrawCommand(CommandType Type) : Type(Type), Flag(false), Option(0), Text(0), Font(0), Points(0), Stamp(0), Atlas(0), Surface(0), Count(0) {}
+	bool IsState(void) const { return Type < dcLine; }
+};
+
+class DisplayList
+{
+	public:
+		DisplayList(void) : Valid(false) {}
+
+		void Clear(void)
+		{
+			Commands.clear();
+			Strings.clear();
+			Fonts.clear();
+			Points.clear();
+			Stamps.clear();
+			Atlases.clear();
+			Surfaces.clear();
+		}
+
+		void Add(DrawCommand Command, String const *Text, FontData *Font, FlatVector const *Points,
+			std::shared_ptr<PathStamp const> const *Stamp, std::shared_ptr<GlyphAtlas const> const *Atlas,
+			std::shared_ptr<cairo_surface_t> const *Surface)
+		{
+			if (Text != nullptr)
+			{
+				Command.Text = Strings.size();
+				Strings.push_back(*Text);
+			}
+			if (Font != nullptr)
+			{
+				Command.Font = Fonts.size();
+				Fonts.push_back(Font->shared_from_this());
+			}
+			if (Points != nullptr)
+			{
+				Command.Points = this->Points.size();
+				this->Points.insert(this->Points.end(), Points, Points + Command.Count);
+			}
+			if (Stamp != nullptr)
+			{
+				Command.Stamp = Stamps.size();
+				Stamps.push_back(*Stamp);
+			}
+			if (Atlas != nullptr)
+			{
+				Command.Atlas = Atlases.size();
+				Atlases.push_back(*Atlas);
+			}
+			if (Surface != nullptr)
+			{
+				Command.Surface = Surfaces.size();
+				Surfaces.push_back(*Surface);
+			}
+			Commands.push_back(Command);
+		}
+
+		std::vector<DrawCommand> Commands;
+		std::vector<String> Strings;
+		std::vector<Font> Fonts; // Held so evicted fonts survive until replayed
+		std::vector<FlatVector> Points;
+		std::vector<std::shared_ptr<PathStamp const> > Stamps; // Kept alive for replays
+		std::vector<std::shared_ptr<GlyphAtlas const> > Atlases;
+		std::vector<std::shared_ptr<cairo_surface_t> > Surfaces;
+		bool Valid; // False if Draw() needs to be rerecorded before the next replay
+};
+
+// Text measurement happens on one shared context so it works outside of Draw()
+const unsigned int DefaultMeasurementCacheSize = 4096;
+
+static cairo_t *MeasuringContext(void)
+{
+	static cairo_t *Context = nullptr;
+	if (Context == nullptr)
+	{
+		cairo_surface_t *Surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+		Context = cairo_create(Surface);
+		cairo_surface_destroy(Surface);
+	}
+	return Context;
+}
+
+// Stamps
+const unsigned int DefaultRoundedPathCacheSize = 256;
+
+static void RoundedRectanglePath(cairo_t *Context, FlatVector const &Start, FlatVector const &Size, float Roundedness)
+{
+	if ((Size[0] <= Roundedness) || (Size[1] <= Roundedness))
+	{
+		cairo_move_to(Context, Start[0], Start[1]);
+		cairo_line_to(Context, Start[0] + Size[0], Start[1]);
+		cairo_line_to(Context, Start[0] + Size[0], Start[1] + Size[1]);
+		cairo_line_to(Context, Start[0], Start[1] + Size[1]);
+	}
+	else
+	{
+		FlatVector ArcCenters[4] =
+		{
+			FlatVector(Start[0], Start[1]),
+			FlatVector(Start[0] + Size[0], Start[1]),
+			FlatVector(Start[0] + Size[0], Start[1] + Size[1]),
+			FlatVector(Start[0], Start[1] + Size[1])
+		};
+		ArcCenters[0] += FlatVector(Roundedness, Roundedness);
+		ArcCenters[1] += FlatVector(-Roundedness, Roundedness);
+		ArcCenters[2] += FlatVector(-Roundedness, -Roundedness);
+		ArcCenters[3] += FlatVector(Roundedness, -Roundedness);
+
+		// Top
+		cairo_move_to(Context, ArcCenters[0][0],  Start[1]);
+		cairo_line_to(Context, ArcCenters[1][0],  Start[1]);
+		cairo_arc(Context, ArcCenters[1][0], ArcCenters[1][1], Roundedness, 1.5f * Pi, 0);
+
+		// Right
+		cairo_line_to(Context, Start[0] + Size[0],  ArcCenters[2][1]);
+		cairo_arc(Context, ArcCenters[2][0], ArcCenters[2][1], Roundedness, 0, 0.5f * Pi);
+
+		// Bottom
+		cairo_line_to(Context, ArcCenters[3][0],  Start[1] + Size[1]);
+		cairo_arc(Context, ArcCenters[3][0], ArcCenters[3][1], Roundedness, 0.5f * Pi, Pi);
+
+		// Left
+		cairo_line_to(Context, Start[0],  ArcCenters[0][1]);
+		cairo_arc(Context, ArcCenters[0][0], ArcCenters[0][1], Roundedness, Pi, 1.5f * Pi);
+	}
+}
+
+PathStamp::PathStamp(std::function<void(cairo_t *Context)> const &Build)
+{
+	cairo_t *Context = MeasuringContext();
+	cairo_new_path(Context);
+	Build(Context);
+	Path = cairo_copy_path(Context);
+	double Left, Top, Right, Bottom;
+	cairo_path_extents(Context, &Left, &Top, &Right, &Bottom);
+	Start = FlatVector(Left, Top);
+	End = FlatVector(Right, Bottom);
+	cairo_new_path(Context);
+}
+
+PathStamp::~PathStamp(void)
+	{ cairo_path_destroy(Path); }
+
+FlatVector const &PathStamp::GetStart(void) const
+	{ return Start; }
+
+FlatVector const &PathStamp::GetEnd(void) const
+	{ return End; }
+
+// Glyph atlases
+GlyphAtlas::GlyphAtlas(String const &Family, unsigned int Size)
+{
+	PangoFontDescription *Description = pango_font_description_new();
+	pango_font_description_set_family(Description, Family.c_str());
+	pango_font_description_set_absolute_size(Description, Size * PANGO_SCALE);
+
+	PangoLayout *Layout = pango_cairo_create_layout(MeasuringContext());
+	pango_layout_set_font_description(Layout, Description);
+	pango_layout_set_text(Layout, "M", -1);
+	PangoRectangle Logical;
+	pango_layout_get_pixel_extents(Layout, nullptr, &Logical);
+	g_object_unref(Layout);
+	CellSize = FlatVector(Logical.width, Logical.height);
+
+	int const Count = LastGlyph - FirstGlyph + 1;
+	Atlas = cairo_image_surface_create(CAIRO_FORMAT_A8, Logical.width * Count, Logical.height);
+	cairo_t *Context = cairo_create(Atlas);
+	Layout = pango_cairo_create_layout(Context);
+	pango_layout_set_font_description(Layout, Description);
+	for (int Index = 0; Index < Count; ++Index)
+	{
+		char const Glyph = FirstGlyph + Index;
+		pango_layout_set_text(Layout, &Glyph, 1);
+		cairo_move_to(Context, Index * Logical.width, 0);
+		pango_cairo_show_layout(Context, Layout);
+		Glyphs[Index] = cairo_surface_create_for_rectangle(Atlas, Index * Logical.width, 0, Logical.width, Logical.height);
+	}
+	g_object_unref(Layout);
+	cairo_destroy(Context);
+	pango_font_description_free(Description);
+}
+
+GlyphAtlas::~GlyphAtlas(void)
+{
+	for (auto Glyph : Glyphs) cairo_surface_destroy(Glyph);
+	cairo_surface_destroy(Atlas);
+}
+
+FlatVector const &GlyphAtlas::GetCellSize(void) const
+	{ return CellSize; }
+
+// Pixel conversion to native endian premultiplied ARGB32, one row at a time
+static inline uint32_t PackPixel(unsigned int Red, unsigned int Green, unsigned int Blue, unsigned int Alpha)
+{
+	// Rounded division by 255
+	auto Premultiply = [Alpha](unsigned int Value) { unsigned int Product = Value * Alpha + 128; return (Product + (Product >> 8)) >> 8; };
+	return (Alpha << 24) | (Premultiply(Red) << 16) | (Premultiply(Green) << 8) | Premultiply(Blue);
+}
+
+// NaN becomes 0, matching the SSE2 path in ConvertGrayFloat
+static inline unsigned int FromFloat(float Value)
+	{ return (Value != Value) ? 0 : (unsigned int)(std::min(1.0f, std::max(0.0f, Value)) * 255.0f + 0.5f); }
+
+static void ConvertRGBA8(uint8_t const *From, uint32_t *To, unsigned int Width)
+{
+	unsigned int Index = 0;
+#ifdef __SSE2__
+	// Four pixels per pass, widened to 16 bits for the premultiply
+	__m128i const Zero = _mm_setzero_si128(), Rounding = _mm_set1_epi16(128),
+		AlphaMask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+	auto Premultiply = [&](__m128i Pixels)
+	{
+		__m128i Alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(Pixels, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		__m128i Product = _mm_add_epi16(_mm_mullo_epi16(Pixels, Alpha), Rounding);
+		Product = _mm_srli_epi16(_mm_add_epi16(Product, _mm_srli_epi16(Product, 8)), 8);
+		Product = _mm_or_si128(_mm_andnot_si128(AlphaMask, Product), _mm_and_si128(AlphaMask, Pixels));
+		// RGBA to BGRA, which is ARGB in a little endian word
+		return _mm_shufflehi_epi16(_mm_shufflelo_epi16(Product, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+	};
+	for (; Index + 4 <= Width; Index += 4)
+	{
+		__m128i const Pixels = _mm_loadu_si128((__m128i const *)(From + Index * 4));
+		__m128i const Low = Premultiply(_mm_unpacklo_epi8(Pixels, Zero)), High = Premultiply(_mm_unpackhi_epi8(Pixels, Zero));
+		_mm_storeu_si128((__m128i *)(To + Index), _mm_packus_epi16(Low, High));
+	}
+#endif
+	for (; Index < Width; ++Index)
+		To[Index] = PackPixel(From[Index * 4], From[Index * 4 + 1], From[Index * 4 + 2], From[Index * 4 + 3]);
+}
+
+static void ConvertRGB8(uint8_t const *From, uint32_t *To, unsigned int Width)
+{
+	// Opaque, so no premultiply; three byte pixels don't shuffle well without SSSE3
+	for (unsigned int Index = 0; Index < Width; ++Index)
+		To[Index] = 0xFF000000 | (From[Index * 3] << 16) | (From[Index * 3 + 1] << 8) | From[Index * 3 + 2];
+}
+
+static void ConvertGray8(uint8_t const *From, uint32_t *To, unsigned int Width)
+{
+	unsigned int Index = 0;
+#ifdef __SSE2__
+	__m128i const Opaque = _mm_set1_epi8(-1);
+	for (; Index + 16 <= Width; Index += 16)
+	{
+		__m128i const Gray = _mm_loadu_si128((__m128i const *)(From + Index));
+		__m128i const Doubled[2] = {_mm_unpacklo_epi8(Gray, Gray), _mm_unpackhi_epi8(Gray, Gray)};
+		__m128i const WithAlpha[2] = {_mm_unpacklo_epi8(Gray, Opaque), _mm_unpackhi_epi8(Gray, Opaque)};
+		for (unsigned int Half = 0; Half < 2; ++Half)
+		{
+			_mm_storeu_si128((__m128i *)(To + Index + Half * 8), _mm_unpacklo_epi16(Doubled[Half], WithAlpha[Half]));
+			_mm_storeu_si128((__m128i *)(To + Index + Half * 8 + 4), _mm_unpackhi_epi16(Doubled[Half], WithAlpha[Half]));
+		}
+	}
+#endif
+	for (; Index < Width; ++Index)
+		To[Index] = 0xFF000000 | (From[Index] * 0x010101);
+}
+
+static void ConvertGrayFloat(float const *From, uint32_t *To, unsigned int Width)
+{
+	unsigned int Index = 0;
+#ifdef __SSE2__
+	__m128 const Zero = _mm_setzero_ps(), One = _mm_set1_ps(1.0f), Scale = _mm_set1_ps(255.0f), Half = _mm_set1_ps(0.5f);
+	__m128i const Opaque = _mm_set1_epi32(0xFF000000);
+	for (; Index + 4 <= Width; Index += 4)
+	{
+		// maxps returns its second operand when either is NaN, so NaN becomes 0; rounded like FromFloat
+		__m128 const Clamped = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(From + Index), Zero), One);
+		__m128i const Gray = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(Clamped, Scale), Half));
+		__m128i const Pixels = _mm_or_si128(_mm_or_si128(Opaque, Gray),
+			_mm_or_si128(_mm_slli_epi32(Gray, 8), _mm_slli_epi32(Gray, 16)));
+		_mm_storeu_si128((__m128i *)(To + Index), Pixels);
+	}
+#endif
+	for (; Index < Width; ++Index)
+		To[Index] = 0xFF000000 | (FromFloat(From[Index]) * 0x010101);
+}
+
+static void ConvertRGBAFloat(float const *From, uint32_t *To, unsigned int Width)
+{
+	for (unsigned int Index = 0; Index < Width; ++Index)
+		To[Index] = PackPixel(FromFloat(From[Index * 4]), FromFloat(From[Index * 4 + 1]),
+			FromFloat(From[Index * 4 + 2]), FromFloat(From[Index * 4 + 3]));
+}
+
+static cairo_surface_t *ConvertPixels(void const *Pixels, PixelFormat Format, unsigned int Width, unsigned int Height, unsigned int Stride)
+{
+	cairo_surface_t *Out = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, Width, Height);
+	if (cairo_surface_status(Out) != CAIRO_STATUS_SUCCESS)
+	{
+		cairo_surface_destroy(Out); // Too large or out of memory, so there's no data to write
+		return nullptr;
+	}
+	cairo_surface_flush(Out);
+	unsigned char *Data = cairo_image_surface_get_data(Out);
+	int const OutStride = cairo_image_surface_get_stride(Out);
+	for (unsigned int Row = 0; Row < Height; ++Row)
+	{
+		uint8_t const *From = (uint8_t const *)Pixels + Row * Stride;
+		uint32_t *To = (uint32_t *)(Data + Row * OutStride);
+		switch (Format)
+		{
+			case pfRGBA8: ConvertRGBA8(From, To, Width); break;
+			case pfRGB8: ConvertRGB8(From, To, Width); break;
+			case pfGray8: ConvertGray8(From, To, Width); break;
+			case pfGrayFloat: ConvertGrayFloat((float const *)From, To, Width); break;
+			case pfRGBAFloat: ConvertRGBAFloat((float const *)From, To, Width); break;
+			default: assert(false); break;
+		}
+	}
+	cairo_surface_mark_dirty(Out);
+	return Out;
+}
+
+// Pango fonts
+const unsigned int DefaultLayoutCacheSize = 256;
+
+const unsigned int DefaultFontCacheSize = 64;
+
+FontCache::FontCache(void) : Fonts(DefaultFontCacheSize, nullptr) {}
+
+FontCache &FontCache::Instance(void)
+{
+	static FontCache Out;
+	return Out;
+}
+
+Font FontCache::Get(String const &Family, unsigned int Size, PangoWeight Weight, PangoStyle Style)
+{
+	FontKey const Key(Family, Size, Weight, Style);
+	Font *Found = Fonts.Find(Key);
+	if (Found != nullptr) return *Found;
+	Font const Out = std::make_shared<FontData>(Family, Size, Weight, Style);
+	Fonts.Add(Key, Out, 1);
+	return Out;
+}
+
+void FontCache::SetCapacity(unsigned int Count)
+	{ Fonts.SetBudget(Count); }
+
+void FontCache::Clear(void)
+	{ Fonts.Clear(); }
+
+FontData::FontData(String const &Family, unsigned int Size, PangoWeight Weight, PangoStyle Style) :
+	PangoFont(pango_font_description_new()),
+	Layouts(DefaultLayoutCacheSize, [](PangoLayout *&Releasee) { g_object_unref(Releasee); }),
+	Hits(0), Misses(0),
+	Measurements(DefaultMeasurementCacheSize, nullptr)
+{
+	pango_font_description_set_family(PangoFont, Family.c_str());
+	pango_font_description_set_absolute_size(PangoFont, Size * PANGO_SCALE);
+	pango_font_description_set_weight(PangoFont, Weight);
+	pango_font_description_set_style(PangoFont, Style);
+
+	PangoLayout *Layout = pango_cairo_create_layout(MeasuringContext());
+	PangoFontMetrics *PangoMetrics = pango_context_get_metrics(pango_layout_get_context(Layout), PangoFont, nullptr);
+	FontMetrics.Ascent = (float)pango_font_metrics_get_ascent(PangoMetrics) / PANGO_SCALE;
+	FontMetrics.Descent = (float)pango_font_metrics_get_descent(PangoMetrics) / PANGO_SCALE;
+	FontMetrics.Height = FontMetrics.Ascent + FontMetrics.Descent;
+	FontMetrics.AverageWidth = (float)pango_font_metrics_get_approximate_char_width(PangoMetrics) / PANGO_SCALE;
+	FontMetrics.DigitWidth = (float)pango_font_metrics_get_approximate_digit_width(PangoMetrics) / PANGO_SCALE;
+	pango_font_metrics_unref(PangoMetrics);
+	g_object_unref(Layout);
 }
 
 FontData::~FontData(void)
-	{ pango_font_description_free(PangoFont); }
+{
+	Layouts.Clear();
+	pango_font_description_free(PangoFont);
+}
+
+FontData::Metrics const &FontData::GetMetrics(void) const
+	{ return FontMetrics; }
 
 void FontData::Print(String const &Text, TextAlignment Alignment, FlatVector const &Position)
 {
-	PangoLayout *Layout = pango_cairo_create_layout(Canvas->GetContext());
-	pango_layout_set_font_description(Layout, PangoFont);
-	pango_layout_set_text(Layout, Text.c_str(), -1);
-
+	VectorArea *Canvas = VectorArea::Active;
+	assert(Canvas != nullptr);
 	int Height, Width;
-	pango_layout_get_size(Layout, &Width, &Height);
+	pango_layout_get_size(GetLayout(Canvas->GetContext(), Text), &Width, &Height);
+
 	FlatVector Size = FlatVector(Width, Height) / PANGO_SCALE;
-	if (Alignment == taLeft)
-		cairo_move_to(Canvas->GetContext(), Position[0], Position[1]);
-	else if (Alignment == taMiddle)
-		cairo_move_to(Canvas->GetContext(), Position[0] - Size[0] * 0.5f, Position[1]);
+	FlatVector Start = Position;
+	if (Alignment == taMiddle)
+		Start[0] -= Size[0] * 0.5f;
 	else if (Alignment == taFullMiddle)
-		cairo_move_to(Canvas->GetContext(), Position[0] - Size[0] * 0.5f, Position[1] - Size[1] * 0.5f);
-	else cairo_move_to(Canvas->GetContext(), Position[0] - Size[0], Position[1]);
+		Start -= Size * 0.5f;
+	else if (Alignment == taRight)
+		Start[0] -= Size[0];
 
-	pango_cairo_show_layout(Canvas->GetContext(), Layout);
-	g_object_unref(Layout);
+	DrawCommand Command(DrawCommand::dcFontText);
+	Command.Arguments[0] = Start[0];
+	Command.Arguments[1] = Start[1];
+	Canvas->Bound(Command, Start, Start + Size, 0);
+	Canvas->Submit(Command, &Text, this);
 }
+
 void FontData::Print(String const &Text, TextAlignment Alignment, Region const &Limits, bool Wrap)
 {
-	PangoLayout *Layout = pango_cairo_create_layout(Canvas->GetContext());
+	VectorArea *Canvas = VectorArea::Active;
+	assert(Canvas != nullptr);
+	int Height, Width;
+	pango_layout_get_size(GetLayout(Canvas->GetContext(), Text, Limits.Size[0], Alignment, Wrap), &Width, &Height);
+
+	DrawCommand Command(DrawCommand::dcFontBoxText);
+	Command.Arguments[0] = Limits.Start[0];
+	Command.Arguments[1] = Limits.Start[1];
+	Command.Arguments[2] = Limits.Size[0];
+	Command.Option = Alignment;
+	Command.Flag = Wrap;
+	Canvas->Bound(Command, Limits.Start, Limits.Start + FlatVector(Limits.Size[0], (float)Height / PANGO_SCALE), 0);
+	Canvas->Submit(Command, &Text, this);
+}
+
+TextExtents FontData::MeasureText(String const &Text)
+{
+	TextExtents *Found = Measurements.Find(Text);
+	if (Found != nullptr) return *Found;
+
+	// Measured on a throwaway layout so the drawing layouts aren't flipped between contexts
+	PangoLayout *Layout = pango_cairo_create_layout(MeasuringContext());
 	pango_layout_set_font_description(Layout, PangoFont);
 	pango_layout_set_text(Layout, Text.c_str(), -1);
-	//
-	pango_layout_set_width(Layout, Limits.Size[0] * PANGO_SCALE);
-	pango_layout_set_alignment(Layout,
-		Alignment == taLeft ? PANGO_ALIGN_LEFT : Alignment == taRight ? PANGO_ALIGN_RIGHT : PANGO_ALIGN_CENTER);
-	if (Wrap) pango_layout_set_wrap(Layout, PANGO_WRAP_WORD);
-	else pango_layout_set_ellipsize(Layout, PANGO_ELLIPSIZE_END);
-
-	/*int Height, Width;
-	pango_layout_get_size(Layout, &Width, &Height);
-	FlatVector Size = FlatVector(Width, Height) / PANGO_SCALE;
-	if (Size[0] > Limits[0])
-	{
-		pango_layout_set_width(Layout, Limits[0] * PANGO_SCALE);
-		pango_layout_set_ellipsize(Layout, PANGO_ELLIPSIZE_END);
-		Size[0] = Limits[0];
-	}*/
-	//if (Alignment == taLeft)
-		cairo_move_to(Canvas->GetContext(), Limits.Start[0], Limits.Start[1]);
-	/*else if (Alignment == taMiddle)
-		cairo_move_to(Canvas->GetContext(), Position[0] - Size[0] * 0.5f, Position[1] - Size[1] * 0.5f);
-	else cairo_move_to(Canvas->GetContext(), Position[0] - Size[0], Position[1]);*/
-
-	pango_cairo_show_layout(Canvas->GetContext(), Layout);
+	PangoRectangle Ink, Logical;
+	pango_layout_get_pixel_extents(Layout, &Ink, &Logical);
+	float const Baseline = (float)pango_layout_get_baseline(Layout) / PANGO_SCALE;
 	g_object_unref(Layout);
+
+	TextExtents Out;
+	Out.Size = FlatVector(Ink.width, Ink.height);
+	Out.Bearing = FlatVector(Ink.x, Ink.y - Baseline);
+	Out.Advance = Logical.width;
+	Out.Ascent = Baseline;
+	Out.Descent = Logical.height - Baseline;
+	Measurements.Add(Text, Out, 1);
+	return Out;
+}
+
+void FontData::SetLayoutCacheSize(unsigned int Capacity)
+	{ Layouts.SetBudget(Capacity); }
+
+FontData::Statistics FontData::GetLayoutStatistics(void) const
+{
+	Statistics Out;
+	Out.Hits = Hits;
+	Out.Misses = Misses;
+	Out.Evictions = Layouts.GetEvictions();
+	Out.Count = Layouts.Count();
+	Out.Capacity = Layouts.GetBudget();
+	return Out;
 }
 
-VectorArea::VectorArea(void) :
+void FontData::ResetLayoutStatistics(void)
+{
+	Hits = 0;
+	Misses = 0;
+	Layouts.ResetEvictions();
+}
+
+PangoLayout *FontData::GetLayout(cairo_t *Context, String const &Text)
+	{ return GetLayout(Context, Text, -1, taLeft, false); }
+
+PangoLayout *FontData::GetLayout(cairo_t *Context, String const &Text, float Width, TextAlignment Alignment, bool Wrap)
+{
+	// Alignment and wrapping mean nothing without a width, so they're left out of the key
+	int const PangoWidth = (Width < 0) ? -1 : (int)(Width * PANGO_SCALE);
+	LayoutKey const Key = (PangoWidth < 0) ?
+		LayoutKey(Text, -1, taLeft, false) : LayoutKey(Text, PangoWidth, Alignment, Wrap);
+
+	PangoLayout **Found = Layouts.Find(Key);
+	if (Found != nullptr)
+	{
+		++Hits;
+		pango_cairo_update_layout(Context, *Found); // Only reshapes if the context changed
+		return *Found;
+	}
+
+	++Misses;
+	PangoLayout *Layout = pango_cairo_create_layout(Context);
+	pango_layout_set_font_description(Layout, PangoFont);
+	pango_layout_set_text(Layout, Text.c_str(), -1);
+	if (PangoWidth >= 0)
+	{
+		pango_layout_set_width(Layout, PangoWidth);
+		pango_layout_set_alignment(Layout,
+			Alignment == taLeft ? PANGO_ALIGN_LEFT : Alignment == taRight ? PANGO_ALIGN_RIGHT : PANGO_ALIGN_CENTER);
+		if (Wrap) pango_layout_set_wrap(Layout, PANGO_WRAP_WORD);
+		else pango_layout_set_ellipsize(Layout, PANGO_ELLIPSIZE_END);
+	}
+	Layouts.Add(Key, Layout, 1);
+	return Layout;
+}
+
+void FontData::Show(cairo_t *Context, DrawCommand const &Command, String const &Text)
+{
+	PangoLayout *Layout = (Command.Type == DrawCommand::dcFontBoxText) ?
+		GetLayout(Context, Text, Command.Arguments[2], (TextAlignment)Command.Option, Command.Flag) :
+		GetLayout(Context, Text);
+	cairo_move_to(Context, Command.Arguments[0], Command.Arguments[1]);
+	pango_cairo_show_layout(Context, Layout);
+}
+
+// Cairo drawing area
+thread_local VectorArea *VectorArea::Active = nullptr;
+
+VectorArea::VectorArea(GtkWidget *Data) :
 	Left(false), Middle(false), Right(false),
-	Data(gtk_drawing_area_new()),
-	FillOn(false), Roundedness(3.0f),
-	CairoContext(NULL), ShouldPartialRefresh(false)
+	Data(Data),
+	Offscreen(false),
+	FillOn(false), Roundedness(3.0f), LineWidth(2.0f), FontSize(12),
+	ScrollOffset(0, 0),
+	CairoContext(NULL),
+	Retained(nullptr), Exposing(nullptr), Recorder(nullptr),
+	Store(nullptr), StoreDamage(nullptr),
+	Frames(Data),
+	TileSize(0),
+	AsynchronousImages(false),
+	Hovering(false), Hovered(0),
+	Motion(mmEvery), LastMotion(0), MotionTimerID(0)
+	{ ResetDrawStatistics(); }
+
+VectorArea::VectorArea(void) : VectorArea(gtk_drawing_area_new())
 {
 	gtk_widget_set_can_focus(Data, true);
 	gtk_widget_add_events(Data, 
@@ -83,315 +773,1302 @@ VectorArea::VectorArea(void) :
 	g_signal_connect(G_OBJECT(Data), "leave-notify-event", G_CALLBACK(LeaveHandler), this);
 }
 
+VectorArea::VectorArea(FlatVector const &HeadlessSize) : VectorArea((GtkWidget *)nullptr)
+	{ OffscreenSize = HeadlessSize; }
+
 VectorArea::~VectorArea(void)
-	{}
+{
+	if (MotionTimerID != 0) g_source_remove(MotionTimerID);
+	for (auto &Request : ImageRequests) ImageLoader::Instance().Cancel(Request.second);
+	delete Retained;
+	SetBackingStore(false);
+}
 
 VectorArea::operator GtkWidget*(void)
 	{ return Data; }
 
 void VectorArea::Refresh(void)
 {
-	if (!GDK_IS_WINDOW(Data->window)) return;
+	if (Data == nullptr) return;
 	GdkRectangle Region;
 	Region.x = 0;
 	Region.y = 0;
 	Region.width = Data->allocation.width;
 	Region.height = Data->allocation.height;
-	gdk_window_invalidate_rect(Data->window, &Region, false);
-	gdk_window_process_updates(Data->window, false);
+	Damage(Region, true);
+	Frames.Invalidate(Region);
 }
 
 void VectorArea::RedrawArea(const FlatVector &Position, const FlatVector &Size)
 {
+	if (Data == nullptr) return;
 	GdkRectangle Region;
 	Region.x = Position[0];
 	Region.y = Position[1];
 	Region.width = Size[0];
 	Region.height = Size[1];
-	gdk_window_invalidate_rect(Data->window, &Region, false);
-	ShouldPartialRefresh = true;
+	Damage(Region, false); // Small redraws like a cursor blink would cost a full recording
+	Frames.Invalidate(Region);
+}
+
+void VectorArea::PartialRefresh(void)
+	{ Frames.Flush(); }
+
+void VectorArea::FlushRefresh(void)
+	{ Frames.Flush(); }
+
+void VectorArea::SetMaximumFrameRate(float FramesPerSecond)
+	{ Frames.SetMaximumRate(FramesPerSecond); }
+
+void VectorArea::SetMotionMode(MotionMode Mode)
+{
+	Motion = Mode;
+	MotionSamples.clear();
+	if (MotionTimerID != 0)
+	{
+		g_source_remove(MotionTimerID);
+		MotionTimerID = 0;
+	}
+	if (Data == nullptr) return;
+
+	// Hints would drop the intermediate positions
+	GdkEventMask const Hint = GDK_POINTER_MOTION_HINT_MASK;
+	if (gtk_widget_get_realized(Data))
+	{
+		GdkEventMask const Events = gdk_window_get_events(Data->window);
+		gdk_window_set_events(Data->window, (GdkEventMask)((Mode == mmHistory) ? (Events & ~Hint) : (Events | Hint)));
+	}
+	else
+	{
+		gint const Events = gtk_widget_get_events(Data); // GTK only allows this before realization
+		gtk_widget_set_events(Data, (Mode == mmHistory) ? (Events & ~Hint) : (Events | Hint));
+	}
+}
+
+void VectorArea::RequestSize(const FlatVector &Size)
+{
+	if (Data == nullptr) OffscreenSize = Size;
+	else gtk_widget_set_size_request(Data, Size[0], Size[1]);
+}
+
+void VectorArea::SetBackgroundColor(const Color &NewColor)
+{
+	if (Data == nullptr) return;
+	GdkColor SetColor;
+	SetColor.red = 65535 * NewColor.Red;
+	SetColor.green = 65535 * NewColor.Green;
+	SetColor.blue = 65535 * NewColor.Blue;
+	gtk_widget_modify_bg(Data, GTK_STATE_NORMAL, &SetColor);
+	if (StoreDamage != nullptr)
+	{
+		GdkRectangle Region = {0, 0, Data->allocation.width, Data->allocation.height};
+		gdk_region_union_with_rect(StoreDamage, &Region);
+	}
+}
+
+void VectorArea::SetBackingStore(bool On)
+{
+	if (On == (StoreDamage != nullptr)) return;
+	if (On) StoreDamage = gdk_region_new();
+	else
+	{
+		if (Store != nullptr) cairo_surface_destroy(Store);
+		Store = nullptr;
+		gdk_region_destroy(StoreDamage);
+		StoreDamage = nullptr;
+	}
+}
+
+void VectorArea::SetOffset(FlatVector const &Offset)
+{
+	if ((Offset[0] == ScrollOffset[0]) && (Offset[1] == ScrollOffset[1])) return;
+	float const DeltaX = Offset[0] - ScrollOffset[0], DeltaY = Offset[1] - ScrollOffset[1];
+	if ((Data == nullptr) || !GDK_IS_WINDOW(Data->window) ||
+		(DeltaX != std::round(DeltaX)) || (DeltaY != std::round(DeltaY)) ||
+		(std::abs(DeltaX) >= Data->allocation.width) || (std::abs(DeltaY) >= Data->allocation.height))
+	{
+		ScrollOffset = Offset;
+		Refresh();
+		return;
+	}
+
+	Frames.Flush(); // Pending damage is where the old offset put it
+	ScrollOffset = Offset;
+	if (StoreDamage != nullptr) ScrollStore(DeltaX, DeltaY);
+	gdk_window_scroll(Data->window, -DeltaX, -DeltaY); // Copies the pixels and exposes the rest
+}
+
+FlatVector VectorArea::GetOffset(void) const
+	{ return ScrollOffset; }
+
+void VectorArea::Translate(const FlatVector &Translation)
+{
+	Offset += Translation;
+	DrawCommand Command(DrawCommand::dcTranslate);
+	Command.Arguments[0] = Translation[0];
+	Command.Arguments[1] = Translation[1];
+	Submit(Command);
+}
+
+void VectorArea::SetColor(const Color &NewColor)
+{
+	DrawCommand Command(DrawCommand::dcColor);
+	Command.Arguments[0] = NewColor.Red;
+	Command.Arguments[1] = NewColor.Green;
+	Command.Arguments[2] = NewColor.Blue;
+	Command.Arguments[3] = NewColor.Alpha;
+	Submit(Command);
+}
+
+void VectorArea::SetWidth(float Width)
+{
+	LineWidth = Width;
+	DrawCommand Command(DrawCommand::dcWidth);
+	Command.Arguments[0] = Width;
+	Submit(Command);
+}
+
+void VectorArea::SetCap(bool Rounded)
+{
+	DrawCommand Command(DrawCommand::dcCap);
+	Command.Flag = Rounded;
+	Submit(Command);
+}
+
+void VectorArea::SetFill(bool On)
+	{ FillOn = On; }
+void VectorArea::SetRoundedness(float Roundedness)
+	{ this->Roundedness = Roundedness; }
+
+void VectorArea::SetFontSize(unsigned int NewSize)
+{
+	FontSize = NewSize;
+	DrawCommand Command(DrawCommand::dcFontSize);
+	Command.Arguments[0] = NewSize;
+	Submit(Command);
+}
+
+float VectorArea::GetTextWidth(const String &Text)
+	{ return MeasureText(Text, (CairoContext == NULL) ? 12 : FontSize).Size[0]; }
+
+TextExtents VectorArea::MeasureText(String const &Text)
+	{ return MeasureText(Text, FontSize); }
+
+TextExtents VectorArea::MeasureText(String const &Text, unsigned int Size)
+{
+	static LRUCache<std::pair<unsigned int, String>, TextExtents> Measurements(DefaultMeasurementCacheSize, nullptr);
+
+	std::pair<unsigned int, String> const Key(Size, Text);
+	TextExtents *Found = Measurements.Find(Key);
+	if (Found != nullptr) return *Found;
+
+	cairo_t *Context = MeasuringContext();
+	cairo_set_font_size(Context, Size);
+	cairo_text_extents_t Extents;
+	cairo_text_extents(Context, Text.c_str(), &Extents);
+	cairo_font_extents_t FontExtents;
+	cairo_font_extents(Context, &FontExtents);
+
+	TextExtents Out;
+	Out.Size = FlatVector(Extents.width, Extents.height);
+	Out.Bearing = FlatVector(Extents.x_bearing, Extents.y_bearing);
+	Out.Advance = Extents.x_advance;
+	Out.Ascent = FontExtents.ascent;
+	Out.Descent = FontExtents.descent;
+	Measurements.Add(Key, Out, 1);
+	return Out;
+}
+
+void VectorArea::PrintNumber(float Number, TextAlignment Alignment, const FlatVector &Position)
+{
+	MemoryStream ToText;
+	ToText << Number;
+	Print(ToText, Alignment, Position);
 }
 
-void VectorArea::PartialRefresh(void)
+void VectorArea::PrintHex(unsigned int Number, TextAlignment Alignment, const FlatVector &Position)
+{
+	MemoryStream ToText;
+	ToText << OutputStream::Hex(Number);
+	Print(ToText, Alignment, Position);
+}
+
+void VectorArea::Print(String const &Text, TextAlignment Alignment, FlatVector const &Position)
+{
+	TextExtents const Extents = MeasureText(Text, FontSize);
+
+	FlatVector Start = Position + FlatVector(-Extents.Bearing[0], Extents.Ascent - Extents.Descent);
+	if (Alignment == taMiddle)
+		Start[0] -= Extents.Size[0] * 0.5f;
+	else if (Alignment == taFullMiddle)
+		Start += FlatVector(-Extents.Size[0] * 0.5f, -Extents.Ascent * 0.5f);
+	else if (Alignment == taRight)
+		Start[0] -= Extents.Size[0] - Extents.Bearing[0];
+
+	SubmitText(Text, Start, Extents);
+}
+
+void VectorArea::Print(String const &Text, FlatVector const &Alignment, FlatVector const &Position)
+{
+	TextExtents const Extents = MeasureText(Text, FontSize);
+
+	FlatVector Size(Extents.Size[0], Extents.Descent + Extents.Ascent * 0.9f);
+
+	FlatVector Start = Position +
+		FlatVector(-Extents.Bearing[0], -Extents.Descent) +
+		Size * (FlatVector(-0.5f, 0.5f) + 0.5f * Alignment);
+
+	SubmitText(Text, Start, Extents);
+}
+
+void VectorArea::DrawGlyphs(std::shared_ptr<GlyphAtlas const> const &Atlas, FlatVector const &Position, String const &Text)
+{
+	DrawCommand Command(DrawCommand::dcGlyphs);
+	Command.Arguments[0] = Position[0];
+	Command.Arguments[1] = Position[1];
+	FlatVector const &Cell = Atlas->GetCellSize();
+	Bound(Command, Position, Position + FlatVector(Cell[0] * Text.length(), Cell[1]), 0);
+	Submit(Command, &Text, nullptr, nullptr, nullptr, &Atlas);
+}
+
+void VectorArea::DrawHexGlyphs(std::shared_ptr<GlyphAtlas const> const &Atlas, FlatVector const &Position,
+	unsigned int Number, unsigned int Digits)
+{
+	static char const Hex[] = "0123456789ABCDEF";
+	char Buffer[8];
+	Digits = std::min(Digits, 8u);
+	for (unsigned int Index = 0; Index < Digits; ++Index)
+		Buffer[Digits - Index - 1] = Hex[(Number >> (Index * 4)) & 0xF];
+	DrawGlyphs(Atlas, Position, String(Buffer, Digits));
+}
+
+void VectorArea::DrawNumberGlyphs(std::shared_ptr<GlyphAtlas const> const &Atlas, FlatVector const &Position, int Number)
+{
+	char Buffer[11];
+	unsigned int Start = sizeof(Buffer);
+	unsigned int Magnitude = (Number < 0) ? -(unsigned int)Number : Number;
+	do
+	{
+		Buffer[--Start] = '0' + Magnitude % 10;
+		Magnitude /= 10;
+	} while (Magnitude > 0);
+	if (Number < 0) Buffer[--Start] = '-';
+	DrawGlyphs(Atlas, Position, String(Buffer + Start, sizeof(Buffer) - Start));
+}
+
+void VectorArea::DrawLine(const FlatVector &Start, const FlatVector &End)
+{
+	DrawCommand Command(DrawCommand::dcLine);
+	Command.Arguments[0] = Start[0];
+	Command.Arguments[1] = Start[1];
+	Command.Arguments[2] = End[0];
+	Command.Arguments[3] = End[1];
+	Bound(Command,
+		FlatVector(std::min(Start[0], End[0]), std::min(Start[1], End[1])),
+		FlatVector(std::max(Start[0], End[0]), std::max(Start[1], End[1])), LineWidth);
+	Submit(Command);
+}
+
+void VectorArea::DrawRectangle(const FlatVector &Start, const FlatVector &Size)
+{
+	DrawCommand Command(DrawCommand::dcRectangle);
+	Command.Flag = FillOn;
+	Command.Arguments[0] = Start[0];
+	Command.Arguments[1] = Start[1];
+	Command.Arguments[2] = Size[0];
+	Command.Arguments[3] = Size[1];
+	Bound(Command, Start, Start + Size, FillOn ? 0 : LineWidth);
+	Submit(Command);
+}
+
+void VectorArea::DrawRoundedRectangle(const FlatVector &Start, const FlatVector &Size)
+{
+	// Boxes tend to come in a few sizes, so their paths are built once and stamped
+	typedef std::tuple<float, float, float> RoundedKey;
+	static LRUCache<RoundedKey, std::shared_ptr<PathStamp const> > Paths(DefaultRoundedPathCacheSize, nullptr);
+
+	RoundedKey const Key(Size[0], Size[1], Roundedness);
+	std::shared_ptr<PathStamp const> *Found = Paths.Find(Key);
+	if (Found != nullptr)
+	{
+		DrawStamp(*Found, Start);
+		return;
+	}
+
+	float const Radius = Roundedness;
+	std::shared_ptr<PathStamp const> const Stamp = std::make_shared<PathStamp const>([&Size, Radius](cairo_t *Context)
+		{ RoundedRectanglePath(Context, FlatVector(0, 0), Size, Radius); });
+	Paths.Add(Key, Stamp, 1);
+	DrawStamp(Stamp, Start);
+}
+
+void VectorArea::DrawStamp(std::shared_ptr<PathStamp const> const &Stamp, FlatVector const &Position)
+{
+	DrawCommand Command(DrawCommand::dcStamp);
+	Command.Flag = FillOn;
+	Command.Arguments[0] = Position[0];
+	Command.Arguments[1] = Position[1];
+	Bound(Command, Position + Stamp->GetStart(), Position + Stamp->GetEnd(), FillOn ? 0 : LineWidth);
+	Submit(Command, nullptr, nullptr, nullptr, &Stamp);
+}
+
+void VectorArea::DrawCircle(const FlatVector &Position, float Radius)
+{
+	DrawCommand Command(DrawCommand::dcCircle);
+	Command.Flag = FillOn;
+	Command.Arguments[0] = Position[0];
+	Command.Arguments[1] = Position[1];
+	Command.Arguments[2] = Radius;
+	Bound(Command, Position - FlatVector(Radius, Radius), Position + FlatVector(Radius, Radius), FillOn ? 0 : LineWidth);
+	Submit(Command);
+}
+
+void VectorArea::DrawArc(const FlatVector &Position, float Radius, float AngleStart, float AngleEnd)
+{
+	DrawCommand Command(DrawCommand::dcArc);
+	Command.Flag = FillOn;
+	Command.Arguments[0] = Position[0];
+	Command.Arguments[1] = Position[1];
+	Command.Arguments[2] = Radius;
+	Command.Arguments[3] = AngleStart / 180.0f * Pi;
+	Command.Arguments[4] = AngleEnd / 180.0f * Pi;
+	Bound(Command, Position - FlatVector(Radius, Radius), Position + FlatVector(Radius, Radius), FillOn ? 0 : LineWidth);
+	Submit(Command);
+}
+
+void VectorArea::DrawLines(FlatVector const *Points, unsigned int Count)
+{
+	if (Count == 0) return;
+	DrawCommand Command(DrawCommand::dcLines);
+	Command.Count = Count * 2;
+	SubmitBatch(Command, Points, LineWidth);
+}
+
+void VectorArea::DrawPolyline(FlatVector const *Points, unsigned int Count)
+{
+	if (Count < 2) return;
+	DrawCommand Command(DrawCommand::dcPolyline);
+	Command.Flag = FillOn;
+	Command.Count = Count;
+	SubmitBatch(Command, Points, FillOn ? 0 : LineWidth);
+}
+
+void VectorArea::DrawRectangles(FlatVector const *Rectangles, unsigned int Count)
+{
+	if (Count == 0) return;
+	DrawCommand Command(DrawCommand::dcRectangles);
+	Command.Flag = FillOn;
+	Command.Count = Count * 2;
+
+	// Sizes may be negative, so bound the far corners rather than the sizes
+	FlatVector Start = Rectangles[0], End = Rectangles[0];
+	for (unsigned int Index = 0; Index < Count; ++Index)
+	{
+		FlatVector const &Corner = Rectangles[Index * 2];
+		FlatVector const Far = Corner + Rectangles[Index * 2 + 1];
+		Start = FlatVector(std::min(Start[0], std::min(Corner[0], Far[0])), std::min(Start[1], std::min(Corner[1], Far[1])));
+		End = FlatVector(std::max(End[0], std::max(Corner[0], Far[0])), std::max(End[1], std::max(Corner[1], Far[1])));
+	}
+	Bound(Command, Start, End, FillOn ? 0 : LineWidth);
+	Submit(Command, nullptr, nullptr, Rectangles);
+}
+
+void VectorArea::DrawCircles(FlatVector const *Positions, unsigned int Count, float Radius)
+{
+	if (Count == 0) return;
+	DrawCommand Command(DrawCommand::dcCircles);
+	Command.Flag = FillOn;
+	Command.Count = Count;
+	Command.Arguments[0] = Radius;
+	SubmitBatch(Command, Positions, (FillOn ? 0 : LineWidth) + Radius);
+}
+
+void VectorArea::DrawSeries(float const *Samples, unsigned int Count, RangeF const &Visible, RangeF const &Values,
+	Region const &Target)
+{
+	if ((Count < 2) || (Visible.Length() <= 0) || (Values.Length() <= 0) || (Target.Size[0] < 1)) return;
+	float const XScale = Target.Size[0] / Visible.Length(), YScale = Target.Size[1] / Values.Length();
+	auto Place = [&](unsigned int Index)
+	{
+		return FlatVector(Target.Start[0] + (float)(((double)Index - Visible.Min) * XScale),
+			Target.Start[1] + Target.Size[1] - (Samples[Index] - Values.Min) * YScale);
+	};
+
+	// Includes the samples just outside so the line reaches the edges; indices in double, as float loses them past 2^24
+	double const Final = Count - 1;
+	if ((Visible.Max < 0) || (Visible.Min > Final)) return;
+	unsigned int const First = (unsigned int)std::min(Final, std::max(0.0, floor((double)Visible.Min)));
+	unsigned int const Last = (unsigned int)std::min(Final, std::max(0.0, ceil((double)Visible.Max)));
+	if (First >= Last) return;
+
+	std::vector<FlatVector> Points;
+	unsigned int const Columns = (unsigned int)ceilf(Target.Size[0]);
+	if (Last - First < Columns * 4)
+	{
+		for (unsigned int Index = First; Index <= Last; ++Index) Points.push_back(Place(Index));
+	}
+	else
+	{
+		Points.reserve(Columns * 4 + 8);
+		unsigned int Previous = Last + 1;
+		auto Add = [&](unsigned int Index)
+		{
+			if (Index == Previous) return;
+			Points.push_back(Place(Index));
+			Previous = Index;
+		};
+		unsigned int Start = First;
+		while (Start <= Last)
+		{
+			// End is the first sample in the next pixel column
+			double const Column = floor(((double)Start - Visible.Min) * XScale);
+			unsigned int End = (unsigned int)std::min(Final + 1, std::max(0.0, ceil((Column + 1) / XScale + Visible.Min)));
+			End = std::min(std::max(End, Start + 1), Last + 1);
+
+			unsigned int Low = Start, High = Start;
+			for (unsigned int Index = Start + 1; Index < End; ++Index)
+			{
+				if (Samples[Index] < Samples[Low]) Low = Index;
+				if (Samples[Index] > Samples[High]) High = Index;
+			}
+			Add(Start);
+			Add(std::min(Low, High));
+			Add(std::max(Low, High));
+			Add(End - 1);
+			Start = End;
+		}
+	}
+
+	DrawCommand Command(DrawCommand::dcPolyline);
+	Command.Count = Points.size();
+	SubmitBatch(Command, &Points[0], LineWidth);
+}
+
+void VectorArea::DrawImage(const String &Filename, const FlatVector &Position, bool Centered)
+{
+	// Get the image size
+	cairo_surface_t *Data = GetImage(Filename);
+	if (Data == nullptr) return;
+	FlatVector Size = FlatVector(
+		cairo_image_surface_get_width(Data),
+		cairo_image_surface_get_height(Data));
+	cairo_surface_destroy(Data);
+
+	// Figure out the draw position
+	FlatVector Corner = Position;
+	if (Centered) Corner -= Size * 0.5f;
+
+	DrawCommand Command(DrawCommand::dcImage);
+	Command.Arguments[0] = Corner[0];
+	Command.Arguments[1] = Corner[1];
+	Bound(Command, Corner, Corner + Size, 0);
+	Submit(Command, &Filename);
+}
+
+void VectorArea::DrawImage(const String &Filename, const FlatVector &Position, Angle Rotation)
+{
+	// Get the image size
+	cairo_surface_t *Data = GetImage(Filename);
+	if (Data == nullptr) return;
+	FlatVector Size = FlatVector(
+		cairo_image_surface_get_width(Data),
+		cairo_image_surface_get_height(Data));
+	cairo_surface_destroy(Data);
+
+	// Any rotation stays within the circle around the corners
+	float const Reach = sqrtf(Size[0] * Size[0] + Size[1] * Size[1]) * 0.5f;
+
+	DrawCommand Command(DrawCommand::dcRotatedImage);
+	Command.Arguments[0] = Position[0];
+	Command.Arguments[1] = Position[1];
+	Command.Arguments[2] = Rotation * ToRadians;
+	Bound(Command, Position - FlatVector(Reach, Reach), Position + FlatVector(Reach, Reach), 0);
+	Submit(Command, &Filename);
+}
+
+void VectorArea::DrawPixels(void const *Pixels, PixelFormat Format, unsigned int Width, unsigned int Height,
+	unsigned int Stride, Region const &Target, bool Smooth)
+{
+	if ((Width == 0) || (Height == 0) || (Target.Size[0] <= 0) || (Target.Size[1] <= 0)) return;
+	DrawCommand Command(DrawCommand::dcPixels);
+	Command.Flag = Smooth;
+	Command.Arguments[0] = Target.Start[0];
+	Command.Arguments[1] = Target.Start[1];
+	Command.Arguments[2] = Target.Size[0];
+	Command.Arguments[3] = Target.Size[1];
+	Bound(Command, Target.Start, Target.Start + Target.Size, 0);
+	if (IsCulled(Command)) 
+	{
+		++Counts.Culled; // Before converting, which costs far more than the test
+		return;
+	}
+	cairo_surface_t *Converted = ConvertPixels(Pixels, Format, Width, Height, Stride);
+	if (Converted == nullptr) return;
+	std::shared_ptr<cairo_surface_t> const Surface(Converted, cairo_surface_destroy);
+	Submit(Command, nullptr, nullptr, nullptr, nullptr, nullptr, &Surface);
+}
+
+Font *VectorArea::GetFont(int Size)
+	{ return new Font(FontCache::Instance().Get("sans", Size)); }
+
+FlatVector VectorArea::GetSize(void)
+{
+	if ((Data == nullptr) || Offscreen) return OffscreenSize;
+	return FlatVector(Data->allocation.width, Data->allocation.height);
+}
+
+SpatialIndex &VectorArea::GetShapes(void)
+	{ return Shapes; }
+
+VectorArea::DrawStatistics VectorArea::GetDrawStatistics(void) const
+	{ return Counts; }
+
+void VectorArea::ResetDrawStatistics(void)
+{
+	Counts.Drawn = 0;
+	Counts.Culled = 0;
+}
+
+void VectorArea::ResizeEvent(FlatVector const &) {}
+void VectorArea::Draw(void) {}
+void VectorArea::Draw(Region const &) { Draw(); }
+void VectorArea::ClickEvent(FlatVector const &, bool, bool, bool) {}
+void VectorArea::DeclickEvent(FlatVector const &, bool, bool, bool) {}
+void VectorArea::ScrollEvent(FlatVector const &, int, int) {}
+void VectorArea::MoveEvent(FlatVector const &) {}
+void VectorArea::MoveHistoryEvent(std::vector<MotionSample> const &) {}
+void VectorArea::EnterEvent(void) {}
+void VectorArea::LeaveEvent(void) {}
+void VectorArea::ShapeClickEvent(std::vector<SpatialIndex::ShapeID> const &, FlatVector const &, bool, bool, bool) {}
+void VectorArea::ShapeMoveEvent(std::vector<SpatialIndex::ShapeID> const &, FlatVector const &) {}
+void VectorArea::ShapeEnterEvent(SpatialIndex::ShapeID) {}
+void VectorArea::ShapeLeaveEvent(SpatialIndex::ShapeID) {}
+
+cairo_t *VectorArea::GetContext(void)
+	{ return CairoContext; }
+
+void VectorArea::SetAsynchronousImages(bool On)
+	{ AsynchronousImages = On; }
+
+cairo_surface_t *VectorArea::GetImage(String const &Filename)
 {
-	if (!ShouldPartialRefresh) return;
-	gdk_window_process_updates(Data->window, false);
-	ShouldPartialRefresh = false;
+	if (!AsynchronousImages) return ImageCache::Instance().Load(Filename);
+	cairo_surface_t *Found = ImageCache::Instance().Find(Filename);
+	if ((Found != nullptr) || (ImageRequests.find(Filename) != ImageRequests.end())) return Found;
+
+	// Failures are retried only once the file changes
+	struct stat FileStatus;
+	if (stat(Filename.c_str(), &FileStatus) != 0) return nullptr;
+	auto Failed = FailedImages.find(Filename);
+	if (Failed != FailedImages.end())
+	{
+		if (Failed->second == FileStatus.st_mtime) return nullptr;
+		FailedImages.erase(Failed);
+	}
+
+	auto Decoded = std::make_shared<bool>(false);
+	time_t const Modified = FileStatus.st_mtime;
+	ImageRequests[Filename] = ImageLoader::Instance().Queue(
+		[Filename, Decoded](void) 
+		{ 
+			cairo_surface_t *Image = ImageCache::Instance().Load(Filename);
+			if (Image == nullptr) return;
+			*Decoded = true;
+			cairo_surface_destroy(Image);
+		},
+		[this, Filename, Decoded, Modified](void)
+		{
+			ImageRequests.erase(Filename);
+			if (!*Decoded) FailedImages[Filename] = Modified;
+			Refresh(); // Even if evicted meanwhile, the redraw requests it again
+		});
+	return nullptr;
 }
 
-void VectorArea::RequestSize(const FlatVector &Size)
-	{ gtk_widget_set_size_request(Data, Size[0], Size[1]); }
+void VectorArea::Composite(cairo_t *) {}
 
-void VectorArea::SetBackgroundColor(const Color &NewColor)
+void VectorArea::Recomposite(GdkRectangle const &Area)
 {
-	GdkColor SetColor;
-	SetColor.red = 65535 * NewColor.Red;
-	SetColor.green = 65535 * NewColor.Green;
-	SetColor.blue = 65535 * NewColor.Blue;
-	gtk_widget_modify_bg(Data, GTK_STATE_NORMAL, &SetColor);
+	if (Data == nullptr) return;
+	if (StoreDamage != nullptr) gdk_region_union_with_rect(StoreDamage, &Area);
+	Frames.Invalidate(Area);
 }
 
-void VectorArea::Translate(const FlatVector &Translation)
-	{ cairo_translate(CairoContext, Translation[0], Translation[1]); }
+void VectorArea::DrawOnto(cairo_surface_t *Target, GdkRegion const *Area, std::function<void(void)> const &Body)
+{
+	cairo_t *OuterContext = CairoContext;
+	DisplayList *OuterRecorder = Recorder;
+	FlatVector const OuterOffset = Offset;
+	float const OuterLineWidth = LineWidth, OuterRoundedness = Roundedness;
+	unsigned int const OuterFontSize = FontSize;
+	bool const OuterFillOn = FillOn;
+	float OuterClip[4];
+	std::copy(Clip, Clip + 4, OuterClip);
+
+	CairoContext = cairo_create(Target);
+	gdk_cairo_region(CairoContext, Area);
+	cairo_clip(CairoContext);
+	cairo_set_operator(CairoContext, CAIRO_OPERATOR_CLEAR);
+	cairo_paint(CairoContext);
+	cairo_set_operator(CairoContext, CAIRO_OPERATOR_OVER);
+	cairo_set_font_size(CairoContext, 12);
+	Recorder = nullptr;
+	Offset = FlatVector(0, 0);
+	LineWidth = 2.0f;
+	FontSize = 12;
+	FillOn = false;
+	Roundedness = 3.0f;
+	GdkRectangle Bounds;
+	gdk_region_get_clipbox(Area, &Bounds);
+	Clip[0] = Bounds.x;
+	Clip[1] = Bounds.y;
+	Clip[2] = Bounds.x + Bounds.width;
+	Clip[3] = Bounds.y + Bounds.height;
+	Translate(-(Offscreen ? FlatVector(0, 0) : ScrollOffset));
+
+	Body();
 
-void VectorArea::SetColor(const Color &NewColor)
-	{ cairo_set_source_rgba(CairoContext, NewColor.Red, NewColor.Green, NewColor.Blue, NewColor.Alpha); }
-void VectorArea::SetWidth(float Width)
-	{ cairo_set_line_width(CairoContext, Width); }
-void VectorArea::SetCap(bool Rounded)
-	{ cairo_set_line_cap(CairoContext, Rounded ? CAIRO_LINE_CAP_ROUND : CAIRO_LINE_CAP_BUTT); }
-void VectorArea::SetFill(bool On)
-	{ FillOn = On; }
-void VectorArea::SetRoundedness(float Roundedness)
-	{ this->Roundedness = Roundedness; }
+	cairo_destroy(CairoContext);
+	cairo_surface_flush(Target);
+	CairoContext = OuterContext;
+	Recorder = OuterRecorder;
+	Offset = OuterOffset;
+	LineWidth = OuterLineWidth;
+	Roundedness = OuterRoundedness;
+	FontSize = OuterFontSize;
+	FillOn = OuterFillOn;
+	std::copy(OuterClip, OuterClip + 4, Clip);
+}
 
-void VectorArea::SetFontSize(unsigned int NewSize)
-	{ cairo_set_font_size(CairoContext, NewSize); }
+bool VectorArea::IsOffscreen(void) const
+	{ return Offscreen || (Data == nullptr); }
 
-float VectorArea::GetTextWidth(const String &Text)
+void VectorArea::SetTiled(bool On, unsigned int TileSize)
 {
-	bool WasNull = false;
-	cairo_surface_t *TempSurface = NULL;
-	if (CairoContext == NULL)
-	{
-		WasNull = true;
-		TempSurface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 0, 0);
-		CairoContext = cairo_create(TempSurface);
-		cairo_set_font_size(CairoContext, 12);
-	}
-
-	cairo_text_extents_t Extents;
-	cairo_text_extents(CairoContext, Text.c_str(), &Extents);
+	assert(!On || (TileSize > 0));
+	this->TileSize = On ? TileSize : 0;
+}
 
-	if (WasNull)
+bool VectorArea::RenderTo(cairo_surface_t *Target, FlatVector const &Size)
+{
+	if ((Data == nullptr) && ((Size[0] != OffscreenSize[0]) || (Size[1] != OffscreenSize[1])))
 	{
-		cairo_destroy(CairoContext);
-		cairo_surface_destroy(TempSurface);
-		CairoContext = NULL;
+		OffscreenSize = Size;
+		ResizeEvent(Size);
 	}
 
-	return Extents.width;
+	// Retained lists and tiles belong to the window, and tiles would rasterize vector targets
+	DisplayList *WindowRetained = Retained;
+	unsigned int WindowTileSize = TileSize;
+	Retained = nullptr;
+	TileSize = 0;
+	Offscreen = true;
+	FlatVector const WindowSize = OffscreenSize;
+	OffscreenSize = Size;
+
+	cairo_t *Context = cairo_create(Target);
+	Render(Context, 0, 0, Size[0], Size[1]);
+	bool const Okay = cairo_status(Context) == CAIRO_STATUS_SUCCESS;
+	cairo_destroy(Context);
+	cairo_surface_flush(Target);
+
+	OffscreenSize = WindowSize;
+	Offscreen = false;
+	TileSize = WindowTileSize;
+	Retained = WindowRetained;
+	return Okay;
 }
 
-void VectorArea::PrintNumber(float Number, TextAlignment Alignment, const FlatVector &Position)
+bool VectorArea::SavePNG(String const &Filename, FlatVector const &Size)
 {
-	MemoryStream ToText;
-	ToText << Number;
-	Print(ToText, Alignment, Position);
+	cairo_surface_t *Target = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, Size[0], Size[1]);
+	bool const Okay = RenderTo(Target, Size) &&
+		(cairo_surface_write_to_png(Target, Filename.c_str()) == CAIRO_STATUS_SUCCESS);
+	cairo_surface_destroy(Target);
+	return Okay;
 }
 
-void VectorArea::PrintHex(unsigned int Number, TextAlignment Alignment, const FlatVector &Position)
+bool VectorArea::SaveSVG(String const &Filename, FlatVector const &Size)
 {
-	MemoryStream ToText;
-	ToText << OutputStream::Hex(Number);
-	Print(ToText, Alignment, Position);
+	cairo_surface_t *Target = cairo_svg_surface_create(Filename.c_str(), Size[0], Size[1]);
+	bool Okay = RenderTo(Target, Size);
+	cairo_surface_finish(Target); // Writes the file
+	Okay = Okay && (cairo_surface_status(Target) == CAIRO_STATUS_SUCCESS);
+	cairo_surface_destroy(Target);
+	return Okay;
 }
 
-void VectorArea::Print(String const &Text, TextAlignment Alignment, FlatVector const &Position)
+bool VectorArea::SavePDF(String const &Filename, FlatVector const &Size)
 {
-	cairo_text_extents_t Extents;
-	cairo_text_extents(CairoContext, Text.c_str(), &Extents);
-	cairo_font_extents_t FontExtents;
-	cairo_font_extents(CairoContext, &FontExtents);
-
-	FlatVector Start = Position + FlatVector(-Extents.x_bearing, FontExtents.ascent - FontExtents.descent);
-	if (Alignment == taMiddle)
-		Start[0] -= Extents.width * 0.5f;
-	else if (Alignment == taFullMiddle)
-		Start += FlatVector(-Extents.width * 0.5f, -FontExtents.ascent * 0.5f);
-	else if (Alignment == taRight)
-		Start[0] -= Extents.width - Extents.x_bearing;
-
-	cairo_move_to(CairoContext, Start[0], Start[1]);
-	cairo_show_text(CairoContext, Text.c_str());
+	cairo_surface_t *Target = cairo_pdf_surface_create(Filename.c_str(), Size[0], Size[1]);
+	bool Okay = RenderTo(Target, Size);
+	cairo_surface_finish(Target);
+	Okay = Okay && (cairo_surface_status(Target) == CAIRO_STATUS_SUCCESS);
+	cairo_surface_destroy(Target);
+	return Okay;
 }
 
-void VectorArea::Print(String const &Text, FlatVector const &Alignment, FlatVector const &Position)
+void VectorArea::SetRetained(bool On)
 {
-	cairo_text_extents_t Extents;
-	cairo_text_extents(CairoContext, Text.c_str(), &Extents);
-	cairo_font_extents_t FontExtents;
-	cairo_font_extents(CairoContext, &FontExtents);
-
-	FlatVector Size(Extents.width, FontExtents.descent + FontExtents.ascent * 0.9f);
+	if (On == (Retained != nullptr)) return;
+	if (On) Retained = new DisplayList;
+	else
+	{
+		delete Retained;
+		Retained = nullptr;
+	}
+}
 
-	FlatVector Start = Position +
-		FlatVector(-Extents.x_bearing, -FontExtents.descent) +
-		Size * (FlatVector(-0.5f, 0.5f) + 0.5f * Alignment);
+void VectorArea::Bound(DrawCommand &Command, FlatVector const &Start, FlatVector const &End, float Padding)
+{
+	// Half the width would do for most strokes, but joins and antialiasing spill a bit further
+	Command.Bounds[0] = Offset[0] + Start[0] - Padding - 1;
+	Command.Bounds[1] = Offset[1] + Start[1] - Padding - 1;
+	Command.Bounds[2] = Offset[0] + End[0] + Padding + 1;
+	Command.Bounds[3] = Offset[1] + End[1] + Padding + 1;
+}
 
-	cairo_move_to(CairoContext, Start[0], Start[1]);
-	cairo_show_text(CairoContext, Text.c_str());
+void VectorArea::SubmitText(String const &Text, FlatVector const &Start, TextExtents const &Extents)
+{
+	DrawCommand Command(DrawCommand::dcText);
+	Command.Arguments[0] = Start[0];
+	Command.Arguments[1] = Start[1];
+	FlatVector const Corner = Start + Extents.Bearing;
+	Bound(Command, Corner, Corner + Extents.Size, 0);
+	Submit(Command, &Text);
 }
 
-void VectorArea::DrawLine(const FlatVector &Start, const FlatVector &End)
+void VectorArea::SubmitBatch(DrawCommand &Command, FlatVector const *Points, float Padding)
 {
-	cairo_move_to(CairoContext, Start[0], Start[1]);
-	cairo_line_to(CairoContext, End[0], End[1]);
-	cairo_stroke(CairoContext);
+	FlatVector Start = Points[0], End = Points[0];
+	for (unsigned int Index = 1; Index < Command.Count; ++Index)
+	{
+		Start = FlatVector(std::min(Start[0], Points[Index][0]), std::min(Start[1], Points[Index][1]));
+		End = FlatVector(std::max(End[0], Points[Index][0]), std::max(End[1], Points[Index][1]));
+	}
+	Bound(Command, Start, End, Padding);
+	Submit(Command, nullptr, nullptr, Points);
 }
 
-void VectorArea::DrawRectangle(const FlatVector &Start, const FlatVector &Size)
+bool VectorArea::IsCulled(DrawCommand const &Command) const
 {
-	cairo_rectangle(CairoContext, Start[0], Start[1], Size[0], Size[1]);
-	if (FillOn) cairo_fill(CairoContext);
-	else cairo_stroke(CairoContext);
+	if (Recorder != nullptr) return false; // Replays cull against their own damage
+	return (Command.Bounds[2] < Clip[0]) || (Command.Bounds[0] > Clip[2]) ||
+		(Command.Bounds[3] < Clip[1]) || (Command.Bounds[1] > Clip[3]);
 }
 
-void VectorArea::DrawRoundedRectangle(const FlatVector &Start, const FlatVector &Size)
+void VectorArea::Submit(DrawCommand const &Command, String const *Text, FontData *Font, FlatVector const *Points,
+	std::shared_ptr<PathStamp const> const *Stamp, std::shared_ptr<GlyphAtlas const> const *Atlas,
+	std::shared_ptr<cairo_surface_t> const *Surface)
 {
-	if ((Size[0] <= Roundedness) || (Size[1] <= Roundedness))
+	if (Recorder != nullptr)
 	{
-		cairo_move_to(CairoContext, Start[0], Start[1]);
-		cairo_line_to(CairoContext, Start[0] + Size[0], Start[1]);
-		cairo_line_to(CairoContext, Start[0] + Size[0], Start[1] + Size[1]);
-		cairo_line_to(CairoContext, Start[0], Start[1] + Size[1]);
+		Recorder->Add(Command, Text, Font, Points, Stamp, Atlas, Surface);
+		return;
 	}
-	else
+	if (!Command.IsState())
 	{
-		FlatVector ArcCenters[4] =
+		if (IsCulled(Command))
 		{
-			FlatVector(Start[0], Start[1]),
-			FlatVector(Start[0] + Size[0], Start[1]),
-			FlatVector(Start[0] + Size[0], Start[1] + Size[1]),
-			FlatVector(Start[0], Start[1] + Size[1])
-		};
-		ArcCenters[0] += FlatVector(Roundedness, Roundedness);
-		ArcCenters[1] += FlatVector(-Roundedness, Roundedness);
-		ArcCenters[2] += FlatVector(-Roundedness, -Roundedness);
-		ArcCenters[3] += FlatVector(Roundedness, -Roundedness);
-
-		// Top
-		cairo_move_to(CairoContext, ArcCenters[0][0],  Start[1]);
-		cairo_line_to(CairoContext, ArcCenters[1][0],  Start[1]);
-		cairo_arc(CairoContext, ArcCenters[1][0], ArcCenters[1][1], Roundedness, 1.5f * Pi, 0);
-
-		// Right
-		cairo_line_to(CairoContext, Start[0] + Size[0],  ArcCenters[2][1]);
-		cairo_arc(CairoContext, ArcCenters[2][0], ArcCenters[2][1], Roundedness, 0, 0.5f * Pi);
+			++Counts.Culled;
+			return;
+		}
+		++Counts.Drawn;
+	}
+	Execute(CairoContext, Command, Text, Font, Points,
+		(Stamp == nullptr) ? nullptr : Stamp->get(), (Atlas == nullptr) ? nullptr : Atlas->get(),
+		(Surface == nullptr) ? nullptr : Surface->get(), AsynchronousImages ? &MissedImages : nullptr);
+}
 
-		// Bottom
-		cairo_line_to(CairoContext, ArcCenters[3][0],  Start[1] + Size[1]);
-		cairo_arc(CairoContext, ArcCenters[3][0], ArcCenters[3][1], Roundedness, 0.5f * Pi, Pi);
+static void FillOrStroke(cairo_t *Context, bool Fill)
+{
+	if (Fill) cairo_fill(Context);
+	else cairo_stroke(Context);
+}
 
-		// Left
-		cairo_line_to(CairoContext, Start[0],  ArcCenters[0][1]);
-		cairo_arc(CairoContext, ArcCenters[0][0], ArcCenters[0][1], Roundedness, Pi, 1.5f * Pi);
+void VectorArea::Execute(cairo_t *Context, DrawCommand const &Command, String const *Text, FontData *Font,
+	FlatVector const *Points, PathStamp const *Stamp, GlyphAtlas const *Atlas, cairo_surface_t *Surface,
+	std::vector<String> *MissedImages)
+{
+	float const *Arguments = Command.Arguments;
+	switch (Command.Type)
+	{
+		case DrawCommand::dcTranslate:
+			cairo_translate(Context, Arguments[0], Arguments[1]);
+			break;
+		case DrawCommand::dcColor:
+			cairo_set_source_rgba(Context, Arguments[0], Arguments[1], Arguments[2], Arguments[3]);
+			break;
+		case DrawCommand::dcWidth:
+			cairo_set_line_width(Context, Arguments[0]);
+			break;
+		case DrawCommand::dcCap:
+			cairo_set_line_cap(Context, Command.Flag ? CAIRO_LINE_CAP_ROUND : CAIRO_LINE_CAP_BUTT);
+			break;
+		case DrawCommand::dcFontSize:
+			cairo_set_font_size(Context, Arguments[0]);
+			break;
+		case DrawCommand::dcLine:
+			cairo_move_to(Context, Arguments[0], Arguments[1]);
+			cairo_line_to(Context, Arguments[2], Arguments[3]);
+			cairo_stroke(Context);
+			break;
+		case DrawCommand::dcRectangle:
+			cairo_rectangle(Context, Arguments[0], Arguments[1], Arguments[2], Arguments[3]);
+			FillOrStroke(Context, Command.Flag);
+			break;
+		case DrawCommand::dcStamp:
+			// Appended paths take the current transformation
+			cairo_translate(Context, Arguments[0], Arguments[1]);
+			cairo_append_path(Context, Stamp->Path);
+			cairo_translate(Context, -Arguments[0], -Arguments[1]);
+			FillOrStroke(Context, Command.Flag);
+			break;
+		case DrawCommand::dcCircle:
+			cairo_arc(Context, Arguments[0], Arguments[1], Arguments[2], 0, 2.0f * Pi);
+			FillOrStroke(Context, Command.Flag);
+			break;
+		case DrawCommand::dcArc:
+			cairo_arc(Context, Arguments[0], Arguments[1], Arguments[2], Arguments[3], Arguments[4]);
+			FillOrStroke(Context, Command.Flag);
+			break;
+		// Batches build one path and rasterize it once
+		case DrawCommand::dcLines:
+			for (unsigned int Index = 0; Index + 1 < Command.Count; Index += 2)
+			{
+				cairo_move_to(Context, Points[Index][0], Points[Index][1]);
+				cairo_line_to(Context, Points[Index + 1][0], Points[Index + 1][1]);
+			}
+			cairo_stroke(Context);
+			break;
+		case DrawCommand::dcPolyline:
+			cairo_move_to(Context, Points[0][0], Points[0][1]);
+			for (unsigned int Index = 1; Index < Command.Count; ++Index)
+				cairo_line_to(Context, Points[Index][0], Points[Index][1]);
+			FillOrStroke(Context, Command.Flag);
+			break;
+		case DrawCommand::dcRectangles:
+			for (unsigned int Index = 0; Index + 1 < Command.Count; Index += 2)
+				cairo_rectangle(Context, Points[Index][0], Points[Index][1], Points[Index + 1][0], Points[Index + 1][1]);
+			FillOrStroke(Context, Command.Flag);
+			break;
+		case DrawCommand::dcCircles:
+			for (unsigned int Index = 0; Index < Command.Count; ++Index)
+			{
+				cairo_new_sub_path(Context); // Otherwise each arc is joined to the last
+				cairo_arc(Context, Points[Index][0], Points[Index][1], Arguments[0], 0, 2.0f * Pi);
+			}
+			FillOrStroke(Context, Command.Flag);
+			break;
+		case DrawCommand::dcText:
+			cairo_move_to(Context, Arguments[0], Arguments[1]);
+			cairo_show_text(Context, Text->c_str());
+			break;
+		case DrawCommand::dcImage:
+		case DrawCommand::dcRotatedImage:
+		{
+			cairo_surface_t *Data = (MissedImages == nullptr) ?
+				ImageCache::Instance().Load(*Text) : ImageCache::Instance().Find(*Text);
+			if (Data == nullptr)
+			{
+				if (MissedImages != nullptr) MissedImages->push_back(*Text);
+				break;
+			}
+			FlatVector Size = FlatVector(
+				cairo_image_surface_get_width(Data),
+				cairo_image_surface_get_height(Data));
+
+			// Saved so the image doesn't remain the source for later commands
+			cairo_save(Context);
+			if (Command.Type == DrawCommand::dcImage)
+			{
+				cairo_set_source_surface(Context, Data, Arguments[0], Arguments[1]);
+				cairo_rectangle(Context, Arguments[0], Arguments[1], Size[0], Size[1]);
+				cairo_fill(Context);
+			}
+			else
+			{
+				cairo_translate(Context, Arguments[0], Arguments[1]);
+				cairo_rotate(Context, Arguments[2]);
+				cairo_set_source_surface(Context, Data, -Size[0] * 0.5f, -Size[1] * 0.5f);
+				cairo_paint(Context);
+			}
+			cairo_restore(Context);
+
+			cairo_surface_destroy(Data);
+			break;
+		}
+		case DrawCommand::dcFontText:
+		case DrawCommand::dcFontBoxText:
+		{
+			// Pango and the layout cache aren't thread safe
+			static std::mutex FontMutex;
+			std::lock_guard<std::mutex> Lock(FontMutex);
+			Font->Show(Context, Command, *Text);
+			break;
+		}
+		case DrawCommand::dcGlyphs:
+		{
+			float const Width = Atlas->CellSize[0];
+			for (unsigned int Index = 0; Index < Text->length(); ++Index)
+			{
+				char const Glyph = (*Text)[Index];
+				if ((Glyph <= GlyphAtlas::FirstGlyph) || (Glyph > GlyphAtlas::LastGlyph)) continue;
+				cairo_mask_surface(Context, Atlas->Glyphs[Glyph - GlyphAtlas::FirstGlyph],
+					Arguments[0] + Index * Width, Arguments[1]);
+			}
+			break;
+		}
+		case DrawCommand::dcPixels:
+		{
+			float const Width = cairo_image_surface_get_width(Surface), Height = cairo_image_surface_get_height(Surface);
+			cairo_save(Context);
+			cairo_rectangle(Context, Arguments[0], Arguments[1], Arguments[2], Arguments[3]);
+			cairo_clip(Context);
+			cairo_translate(Context, Arguments[0], Arguments[1]);
+			cairo_scale(Context, Arguments[2] / Width, Arguments[3] / Height);
+			cairo_set_source_surface(Context, Surface, 0, 0);
+			cairo_pattern_set_filter(cairo_get_source(Context), Command.Flag ? CAIRO_FILTER_BILINEAR : CAIRO_FILTER_NEAREST);
+			cairo_pattern_set_extend(cairo_get_source(Context), CAIRO_EXTEND_PAD); // Keeps smoothed edges opaque
+			cairo_paint(Context);
+			cairo_restore(Context);
+			break;
+		}
+		default: assert(false); break;
 	}
-
-	if (FillOn)
-		cairo_fill(CairoContext);
-	else cairo_stroke(CairoContext);
 }
 
-void VectorArea::DrawCircle(const FlatVector &Position, float Radius)
+void VectorArea::Replay(cairo_t *Context, DisplayList const &List, float const *Clip, DrawStatistics &Counts,
+	std::vector<String> *MissedImages)
 {
-	cairo_arc(CairoContext, Position[0], Position[1], Radius, 0, 2.0f * Pi);
-	if (FillOn) cairo_fill(CairoContext);
-	else cairo_stroke(CairoContext);
+	for (auto &Command : List.Commands)
+	{
+		if (!Command.IsState())
+		{
+			if ((Command.Bounds[2] < Clip[0]) || (Command.Bounds[0] > Clip[2]) ||
+				(Command.Bounds[3] < Clip[1]) || (Command.Bounds[1] > Clip[3]))
+			{
+				++Counts.Culled;
+				continue;
+			}
+			++Counts.Drawn;
+		}
+		Execute(Context, Command,
+			List.Strings.empty() ? nullptr : &List.Strings[Command.Text],
+			List.Fonts.empty() ? nullptr : List.Fonts[Command.Font].get(),
+			List.Points.empty() ? nullptr : &List.Points[Command.Points],
+			List.Stamps.empty() ? nullptr : List.Stamps[Command.Stamp].get(),
+			List.Atlases.empty() ? nullptr : List.Atlases[Command.Atlas].get(),
+			List.Surfaces.empty() ? nullptr : List.Surfaces[Command.Surface].get(), MissedImages);
+	}
 }
 
-void VectorArea::DrawArc(const FlatVector &Position, float Radius, float AngleStart, float AngleEnd)
+void VectorArea::Damage(GdkRectangle const &Area, bool Rerecord)
 {
-	cairo_arc(CairoContext, Position[0], Position[1], Radius,
-		AngleStart / 180.0f * Pi, AngleEnd / 180.0f * Pi);
-	if (FillOn) cairo_fill(CairoContext);
-	else cairo_stroke(CairoContext);
+	if (Rerecord && (Retained != nullptr)) Retained->Valid = false;
+	if (StoreDamage != nullptr) gdk_region_union_with_rect(StoreDamage, &Area);
 }
 
-void VectorArea::DrawImage(const String &Filename, const FlatVector &Position, bool Centered)
+void VectorArea::Render(cairo_t *Target, int X, int Y, int Width, int Height)
 {
-	// Get the image and image data
-	cairo_surface_t *Data =
-		cairo_image_surface_create_from_png(Filename.c_str());
-	if (cairo_surface_status(Data) != CAIRO_STATUS_SUCCESS) return;
-	FlatVector Size = FlatVector(
-		cairo_image_surface_get_width(Data),
-		cairo_image_surface_get_height(Data));
+	CairoContext = Target;
+	VectorArea *Previous = Active;
+	Active = this;
+	cairo_save(CairoContext); // Keeps the clip from narrowing later areas
+	cairo_matrix_t Window;
+	cairo_get_matrix(CairoContext, &Window);
+	//cairo_select_font_face(CairoContext, "sans-serif", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size(CairoContext, 12);
+	cairo_rectangle(CairoContext, X, Y, Width, Height);
+        cairo_clip(CairoContext);
 
-	// Figure out the draw position
-	FlatVector Corner = Position;
-	if (Centered) Corner -= Size * 0.5f;
+	FlatVector const Scroll = Offscreen ? FlatVector(0, 0) : ScrollOffset;
+	Offset = FlatVector(0, 0);
+	LineWidth = 2.0f;
+	FontSize = 12;
+	Clip[0] = X;
+	Clip[1] = Y;
+	Clip[2] = X + Width;
+	Clip[3] = Y + Height;
 
-	// Do the drawing
-	cairo_set_source_surface(CairoContext, Data, Corner[0], Corner[1]);
-	cairo_rectangle(CairoContext, Corner[0], Corner[1], Size[0], Size[1]);
-	cairo_fill(CairoContext);
+	if ((Retained == nullptr) && (TileSize == 0)) 
+	{
+		Translate(-Scroll);
+		Draw(Region(FlatVector(X, Y) + Scroll, FlatVector(Width, Height)));
+	}
+	else
+	{
+		DisplayList Scratch; // Tiled without retaining records each expose, or each render outside one
+		DisplayList *List = (Retained != nullptr) ? Retained : (Exposing != nullptr) ? Exposing : &Scratch;
+		FlatVector const Size = GetSize();
+		if (!List->Valid || 
+			(Scroll[0] < RecordedStart[0]) || (Scroll[1] < RecordedStart[1]) ||
+			(Scroll[0] + Size[0] > RecordedEnd[0]) || (Scroll[1] + Size[1] > RecordedEnd[1]))
+		{
+			// Recorded in Draw() coordinates so scrolling only changes the replay translation
+			FlatVector const Margin = ((List == Retained) && ((Scroll[0] != 0) || (Scroll[1] != 0))) ? 
+				Size : FlatVector(0, 0);
+			RecordedStart = Scroll - Margin;
+			RecordedEnd = Scroll + Size + Margin;
+			List->Clear();
+			Recorder = List;
+			cairo_save(CairoContext);
+			Draw(Region(RecordedStart, RecordedEnd - RecordedStart)); // Replays may need any part
+			cairo_restore(CairoContext);
+			Recorder = nullptr;
+			Offset = FlatVector(0, 0);
+			List->Valid = true;
+		}
+		if (TileSize > 0) RenderTiles(CairoContext, *List, Scroll, X, Y, Width, Height);
+		else 
+		{
+			float const ScrolledClip[4] = {Clip[0] + Scroll[0], Clip[1] + Scroll[1], Clip[2] + Scroll[0], Clip[3] + Scroll[1]};
+			cairo_translate(CairoContext, -Scroll[0], -Scroll[1]);
+			Replay(CairoContext, *List, ScrolledClip, Counts, AsynchronousImages ? &MissedImages : nullptr);
+		}
+	}
 
-	// Clean up
-	cairo_surface_destroy(Data);
+	for (auto &Filename : MissedImages)
+	{
+		cairo_surface_t *Image = GetImage(Filename); // Requests it
+		if (Image != nullptr) cairo_surface_destroy(Image);
+	}
+	MissedImages.clear();
+
+	if (!Offscreen)
+	{
+		cairo_set_matrix(CairoContext, &Window);
+		Composite(CairoContext);
+	}
+
+	cairo_restore(CairoContext);
+	Active = Previous;
+	CairoContext = NULL;
 }
 
-void VectorArea::DrawImage(const String &Filename, const FlatVector &Position, Angle Rotation)
+void VectorArea::RenderTiles(cairo_t *Target, DisplayList const &List, FlatVector const &Scroll, int X, int Y, int Width, int Height)
 {
-	// Get the image and image data
-	cairo_surface_t *Data =
-		cairo_image_surface_create_from_png(Filename.c_str());
-	if (cairo_surface_status(Data) != CAIRO_STATUS_SUCCESS) return;
-	FlatVector Size = FlatVector(
-		cairo_image_surface_get_width(Data),
-		cairo_image_surface_get_height(Data));
+	struct Tile
+	{
+		int X, Y, Width, Height;
+		cairo_surface_t *Surface;
+		DrawStatistics Counts;
+		std::vector<String> MissedImages;
+	};
+	int const Step = TileSize;
+	std::vector<Tile> Tiles;
+	for (int TileY = Y; TileY < Y + Height; TileY += Step)
+		for (int TileX = X; TileX < X + Width; TileX += Step)
+			Tiles.push_back(Tile{TileX, TileY, std::min(Step, X + Width - TileX), std::min(Step, Y + Height - TileY), nullptr, {0, 0}, {}});
+
+	std::vector<ActionHandler> Jobs;
+	bool const Asynchronous = AsynchronousImages;
+	for (auto &Tile : Tiles)
+		Jobs.push_back([&List, &Tile, Scroll, Asynchronous](void)
+		{
+			Tile.Surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, Tile.Width, Tile.Height);
+			cairo_t *Context = cairo_create(Tile.Surface);
+			float const Left = Tile.X + Scroll[0], Top = Tile.Y + Scroll[1];
+			cairo_translate(Context, -Left, -Top);
+			cairo_set_font_size(Context, 12);
+			float const Clip[4] = {Left, Top, Left + Tile.Width, Top + Tile.Height};
+			Replay(Context, List, Clip, Tile.Counts, Asynchronous ? &Tile.MissedImages : nullptr);
+			cairo_destroy(Context);
+		});
+	if (Jobs.size() == 1) Jobs[0]();
+	else WorkerPool::Shared().Run(Jobs);
+
+	cairo_save(Target);
+	for (auto &Tile : Tiles)
+	{
+		cairo_set_source_surface(Target, Tile.Surface, Tile.X, Tile.Y);
+		cairo_rectangle(Target, Tile.X, Tile.Y, Tile.Width, Tile.Height);
+		cairo_fill(Target);
+		cairo_surface_destroy(Tile.Surface);
+		Counts.Drawn += Tile.Counts.Drawn;
+		Counts.Culled += Tile.Counts.Culled;
+		MissedImages.insert(MissedImages.end(), Tile.MissedImages.begin(), Tile.MissedImages.end());
+	}
+	cairo_restore(Target);
+}
 
-	// Do the drawing
-	cairo_matrix_t PreMatrix;
-	cairo_get_matrix(CairoContext, &PreMatrix);
+// Each separate area reruns Draw(), which costs about as much as painting this many extra pixels
+const int SeparateAreaCost = 64 * 64;
+const unsigned int MaximumSeparateAreas = 8;
 
-	cairo_translate(CairoContext, Position[0], Position[1]);
-	cairo_rotate(CairoContext, Rotation * ToRadians);
-	cairo_set_source_surface(CairoContext, Data, -Size[0] * 0.5f, -Size[1] * 0.5f);
-	cairo_paint(CairoContext);
+static int Area(GdkRectangle const &Rectangle)
+	{ return Rectangle.width * Rectangle.height; }
+
+// Splits a region into areas to render separately, merging neighbors where the overdraw is cheaper than
+// another Draw().  The areas are disjoint and within the damage; render each clipped to itself.
+static std::vector<GdkRegion *> SplitRegion(GdkRegion const *Damage)
+{
+	GdkRectangle *Rectangles;
+	gint Count;
+	gdk_region_get_rectangles(Damage, &Rectangles, &Count);
 
-	cairo_set_matrix(CairoContext, &PreMatrix);
+	// Each rectangle joins the area it wastes the least joining, if that's cheap or there are too many areas
+	std::vector<GdkRectangle> Bounds;
+	for (gint Index = 0; Index < Count; ++Index)
+	{
+		GdkRectangle const &Next = Rectangles[Index];
+		int Best = -1, BestWaste = 0;
+		GdkRectangle BestUnion;
+		for (unsigned int Candidate = 0; Candidate < Bounds.size(); ++Candidate)
+		{
+			GdkRectangle Union;
+			gdk_rectangle_union(&Bounds[Candidate], &Next, &Union);
+			int const Waste = Area(Union) - Area(Bounds[Candidate]) - Area(Next);
+			if ((Best >= 0) && (Waste >= BestWaste)) continue;
+			Best = Candidate;
+			BestWaste = Waste;
+			BestUnion = Union;
+		}
+		if ((Best >= 0) && ((BestWaste <= SeparateAreaCost) || (Bounds.size() >= MaximumSeparateAreas)))
+			Bounds[Best] = BestUnion;
+		else Bounds.push_back(Next);
+	}
+	g_free(Rectangles);
 
-	// Clean up
-	cairo_surface_destroy(Data);
+	// Merged bounds can overlap each other and undamaged pixels, so each area keeps only its share of the damage
+	std::vector<GdkRegion *> Out;
+	GdkRegion *Remaining = gdk_region_copy(Damage);
+	for (auto &Rectangle : Bounds)
+	{
+		GdkRegion *Part = gdk_region_rectangle(&Rectangle);
+		gdk_region_intersect(Part, Remaining);
+		gdk_region_subtract(Remaining, Part);
+		if (gdk_region_empty(Part)) gdk_region_destroy(Part);
+		else Out.push_back(Part);
+	}
+	gdk_region_destroy(Remaining);
+	return Out;
 }
 
-Font *VectorArea::GetFont(int Size)
+void VectorArea::RenderDamage(cairo_t *Target, GdkRegion const *Damage)
 {
-	Prune();
-	return Get(std::pair<int, VectorArea *>(Size, this));
+	// The first part records and the rest replay that
+	DisplayList Scratch;
+	if ((Retained == nullptr) && (TileSize > 0)) Exposing = &Scratch;
+	for (auto Part : SplitRegion(Damage))
+	{
+		GdkRectangle Bounds;
+		gdk_region_get_clipbox(Part, &Bounds);
+		cairo_save(Target);
+		gdk_cairo_region(Target, Part);
+		cairo_clip(Target);
+		Render(Target, Bounds.x, Bounds.y, Bounds.width, Bounds.height);
+		cairo_restore(Target);
+		gdk_region_destroy(Part);
+	}
+	Exposing = nullptr;
 }
 
-FlatVector VectorArea::GetSize(void)
+void VectorArea::ScrollStore(int DeltaX, int DeltaY)
 {
-	return FlatVector(Data->allocation.width, Data->allocation.height);
+	GdkRectangle Everything = {0, 0, Data->allocation.width, Data->allocation.height};
+	if (Store != nullptr)
+	{
+		Everything.width = cairo_image_surface_get_width(Store);
+		Everything.height = cairo_image_surface_get_height(Store);
+	}
+	ScrollSurface(Store, Everything, StoreDamage, DeltaX, DeltaY);
 }
 
-void VectorArea::ResizeEvent(FlatVector const &) {}
-void VectorArea::Draw(void) {}
-void VectorArea::ClickEvent(FlatVector const &, bool, bool, bool) {}
-void VectorArea::DeclickEvent(FlatVector const &, bool, bool, bool) {}
-void VectorArea::ScrollEvent(FlatVector const &, int, int) {}
-void VectorArea::MoveEvent(FlatVector const &) {}
-void VectorArea::EnterEvent(void) {}
-void VectorArea::LeaveEvent(void) {}
+void VectorArea::ScrollSurface(cairo_surface_t *Surface, GdkRectangle const &Bounds, GdkRegion *Damage,
+	int DeltaX, int DeltaY)
+{
+	if (Surface != nullptr)
+	{
+		cairo_surface_flush(Surface);
+		unsigned char *Pixels = cairo_image_surface_get_data(Surface);
+		int const Stride = cairo_image_surface_get_stride(Surface);
+		size_t const RowBytes = (Bounds.width - std::abs(DeltaX)) * 4;
+		int const 
+			First = std::max(0, -DeltaY), 
+			Last = Bounds.height - std::max(0, DeltaY); // Exclusive
+		auto Shift = [&](int Row)
+		{
+			memmove(Pixels + Row * Stride + std::max(0, -DeltaX) * 4,
+				Pixels + (Row + DeltaY) * Stride + std::max(0, DeltaX) * 4, RowBytes);
+		};
+		// Rows move against the scroll, so walk them in the order that reads each before it's overwritten
+		if (DeltaY >= 0) for (int Row = First; Row < Last; ++Row) Shift(Row);
+		else for (int Row = Last - 1; Row >= First; --Row) Shift(Row);
+		cairo_surface_mark_dirty(Surface);
+	}
 
-cairo_t *VectorArea::GetContext(void)
-	{ return CairoContext; }
+	// Old damage moves with the pixels, and the strips scrolled in need drawing
+	gdk_region_offset(Damage, -DeltaX, -DeltaY);
+	GdkRegion *Everything = gdk_region_rectangle(&Bounds);
+	GdkRegion *Kept = gdk_region_copy(Everything);
+	gdk_region_offset(Kept, -DeltaX, -DeltaY);
+	GdkRegion *Exposed = gdk_region_copy(Everything);
+	gdk_region_subtract(Exposed, Kept);
+	gdk_region_union(Damage, Exposed);
+	gdk_region_intersect(Damage, Everything);
+	gdk_region_destroy(Exposed);
+	gdk_region_destroy(Kept);
+	gdk_region_destroy(Everything);
+}
 
-void VectorArea::DrawInternal(int X, int Y, int Width, int Height)
+void VectorArea::DrawInternal(GdkRegion const *Exposed)
 {
-	CairoContext = gdk_cairo_create(Data->window);
-	//cairo_select_font_face(CairoContext, "sans-serif", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-	cairo_set_font_size(CairoContext, 12);
-	cairo_rectangle(CairoContext, X, Y, Width, Height);
-        cairo_clip(CairoContext);
+	if (StoreDamage == nullptr)
+	{
+		cairo_t *WindowContext = gdk_cairo_create(Data->window);
+		RenderDamage(WindowContext, Exposed);
+		cairo_destroy(WindowContext);
+		return;
+	}
 
-	Draw();
+	// Bring the backing store up to date; only explicitly damaged areas get redrawn
+	int const StoreWidth = Data->allocation.width, StoreHeight = Data->allocation.height;
+	if ((Store == nullptr) ||
+		(cairo_image_surface_get_width(Store) != StoreWidth) ||
+		(cairo_image_surface_get_height(Store) != StoreHeight))
+	{
+		if (Store != nullptr) cairo_surface_destroy(Store);
+		Store = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, StoreWidth, StoreHeight);
+		GdkRectangle Everything = {0, 0, StoreWidth, StoreHeight};
+		gdk_region_union_with_rect(StoreDamage, &Everything);
+	}
 
-	cairo_destroy(CairoContext);
-	CairoContext = NULL;
+	if (!gdk_region_empty(StoreDamage))
+	{
+		cairo_t *StoreContext = cairo_create(Store);
+		gdk_cairo_region(StoreContext, StoreDamage);
+		cairo_clip(StoreContext);
+		gdk_cairo_set_source_color(StoreContext, &Data->style->bg[GTK_STATE_NORMAL]);
+		cairo_paint(StoreContext);
+		cairo_set_source_rgb(StoreContext, 0, 0, 0);
+		RenderDamage(StoreContext, StoreDamage);
+		cairo_destroy(StoreContext);
+
+		gdk_region_destroy(StoreDamage);
+		StoreDamage = gdk_region_new();
+	}
+
+	// Copy to the window
+	cairo_t *WindowContext = gdk_cairo_create(Data->window);
+	gdk_cairo_region(WindowContext, Exposed);
+	cairo_clip(WindowContext);
+	cairo_set_source_surface(WindowContext, Store, 0, 0);
+	cairo_set_operator(WindowContext, CAIRO_OPERATOR_SOURCE);
+	cairo_paint(WindowContext);
+	cairo_destroy(WindowContext);
 }
 
 gboolean VectorArea::ResizeHandler(GtkWidget *, GdkEventConfigure *, VectorArea *This)
 {
+	if (This->Retained != nullptr) This->Retained->Valid = false;
 	This->ResizeEvent(FlatVector(This->Data->allocation.width, This->Data->allocation.height));
 	return true;
 }
 
 gboolean VectorArea::DrawHandler(GtkWidget *, GdkEventExpose *Event, VectorArea *This)
 {
-	This->DrawInternal(Event->area.x, Event->area.y, Event->area.width, Event->area.height);
+	This->DrawInternal(Event->region);
 	return true;
 }
 
@@ -404,6 +2081,14 @@ gboolean VectorArea::ClickHandler(GtkWidget *, GdkEventButton *Event, VectorArea
 
 	This->ClickEvent(FlatVector(Event->x, Event->y), Event->button == 1, Event->button == 2, Event->button == 3);
 
+	if (This->Shapes.Count() > 0)
+	{
+		std::vector<SpatialIndex::ShapeID> const Hits = This->Shapes.Find(FlatVector(Event->x, Event->y) + This->ScrollOffset);
+		if (!Hits.empty())
+			This->ShapeClickEvent(Hits, FlatVector(Event->x, Event->y),
+				Event->button == 1, Event->button == 2, Event->button == 3);
+	}
+
 	return false;
 }
 
@@ -431,25 +2116,95 @@ gboolean VectorArea::ScrollHandler(GtkWidget *, GdkEventScroll *Event, VectorAre
 
 gboolean VectorArea::MoveHandler(GtkWidget *, GdkEventMotion *Event, VectorArea *This)
 {
-	This->MoveEvent(FlatVector(Event->x, Event->y));
+	FlatVector Cursor(Event->x, Event->y);
+	if (Event->is_hint)
+	{
+		// Acknowledges the hint so the next motion gets reported
+		gint X, Y;
+		gdk_window_get_pointer(Event->window, &X, &Y, nullptr);
+		Cursor = FlatVector(X, Y);
+	}
 	//	Event->state &
 	//         ^ for mouse buttonz, maybe laterz?
 
+	if (This->Motion == mmEvery)
+	{
+		This->DeliverMotion(Cursor);
+		return false;
+	}
+
+	if (This->Motion == mmCompressed) This->MotionSamples.clear();
+	This->MotionSamples.push_back(MotionSample{Cursor, Event->time});
+	if (This->MotionTimerID == 0)
+	{
+		gint64 const Wait = std::max((gint64)0, This->LastMotion + This->Frames.GetPeriod() - g_get_monotonic_time());
+		// Ahead of redraws so the frame shows the delivered position
+		This->MotionTimerID = g_timeout_add_full(GDK_PRIORITY_REDRAW - 1, Wait / 1000,
+			(GSourceFunc)MotionTimeHandler, This, nullptr);
+	}
+
 	return false;
 }
 
+gboolean VectorArea::MotionTimeHandler(VectorArea *This)
+{
+	This->MotionTimerID = 0;
+	This->LastMotion = g_get_monotonic_time();
+	std::vector<MotionSample> Samples;
+	Samples.swap(This->MotionSamples);
+	if (Samples.empty()) return FALSE;
+	if (This->Motion == mmHistory) This->MoveHistoryEvent(Samples);
+	This->DeliverMotion(Samples.back().Position);
+	return FALSE;
+}
+
+void VectorArea::DeliverMotion(FlatVector const &Cursor)
+{
+	MoveEvent(Cursor);
+
+	if ((Shapes.Count() > 0) || Hovering)
+	{
+		std::vector<SpatialIndex::ShapeID> const Hits = Shapes.Find(Cursor + ScrollOffset);
+		UpdateHover(Hits);
+		if (!Hits.empty()) ShapeMoveEvent(Hits, Cursor);
+	}
+}
+
 gboolean VectorArea::EnterHandler(GtkWidget *, GdkEventCrossing *, VectorArea *This)
 	{ This->EnterEvent(); return false; }
 
 gboolean VectorArea::LeaveHandler(GtkWidget *, GdkEventCrossing *, VectorArea *This)
-	{ This->LeaveEvent(); return false; }
+{
+	This->UpdateHover(std::vector<SpatialIndex::ShapeID>());
+	This->LeaveEvent();
+	return false;
+}
+
+void VectorArea::UpdateHover(std::vector<SpatialIndex::ShapeID> const &Hits)
+{
+	if (Hovering && !Hits.empty() && (Hits.front() == Hovered)) return;
+	if (Hovering) ShapeLeaveEvent(Hovered);
+	Hovering = !Hits.empty();
+	if (Hovering)
+	{
+		Hovered = Hits.front();
+		ShapeEnterEvent(Hovered);
+	}
+}
 
 // Slate
+Slate::Slate(void) {}
+
+Slate::Slate(FlatVector const &HeadlessSize) : VectorArea(HeadlessSize) {}
+
 void Slate::SetResizeHandler(decltype(ResizeHandler) const &Handler) 
 	{ ResizeHandler = Handler; }
 	
 void Slate::SetDrawHandler(decltype(DrawHandler) const &Handler) 
 	{ DrawHandler = Handler; }
+
+void Slate::SetDamageDrawHandler(decltype(DamageDrawHandler) const &Handler)
+	{ DamageDrawHandler = Handler; }
 	
 void Slate::SetClickHandler(decltype(ClickHandler) const &Handler)
 	{ ClickHandler = Handler; }
@@ -463,17 +2218,128 @@ void Slate::SetScrollHandler(decltype(ScrollHandler) const &Handler)
 void Slate::SetMoveHandler(decltype(MoveHandler) const &Handler)
 	{ MoveHandler = Handler; }
 	
+void Slate::SetMoveHistoryHandler(decltype(MoveHistoryHandler) const &Handler)
+	{ MoveHistoryHandler = Handler; }
+
 void Slate::SetEnterHandler(decltype(EnterHandler) const &Handler)
 	{ EnterHandler = Handler; }
 	
 void Slate::SetLeaveHandler(decltype(LeaveHandler) const &Handler)
 	{ LeaveHandler = Handler; }
+
+void Slate::SetShapeClickHandler(decltype(ShapeClickHandler) const &Handler)
+	{ ShapeClickHandler = Handler; }
+
+void Slate::SetShapeMoveHandler(decltype(ShapeMoveHandler) const &Handler)
+	{ ShapeMoveHandler = Handler; }
+
+void Slate::SetShapeEnterHandler(decltype(ShapeEnterHandler) const &Handler)
+	{ ShapeEnterHandler = Handler; }
+
+void Slate::SetShapeLeaveHandler(decltype(ShapeLeaveHandler) const &Handler)
+	{ ShapeLeaveHandler = Handler; }
+
+void Slate::SetRetained(bool On)
+	{ VectorArea::SetRetained(On); }
 	
 void Slate::ResizeEvent(FlatVector const &NewSize)
 	{ if (ResizeHandler) ResizeHandler(NewSize); }
 	
-void Slate::Draw(void)
-	{ if (DrawHandler) DrawHandler(); }
+void Slate::AddLayer(String const &Name, std::function<void (Region const &Damage)> const &Handler)
+{
+	Layer *Existing = FindLayer(Name);
+	if (Existing != nullptr) 
+	{
+		Existing->Handler = Handler;
+		Existing->Surface.reset(); // Redrawn whole on the next composite
+	}
+	else Layers.push_back(Layer{Name, Handler, nullptr, FlatVector(0, 0), 
+		std::shared_ptr<GdkRegion>(gdk_region_new(), gdk_region_destroy)});
+	RefreshLayer(Name);
+}
+
+void Slate::RemoveLayer(String const &Name)
+{
+	for (auto Existing = Layers.begin(); Existing != Layers.end(); ++Existing)
+		if (Existing->Name == Name) 
+		{
+			Layers.erase(Existing);
+			FlatVector const Size = GetSize();
+			Recomposite(GdkRectangle{0, 0, (int)Size[0], (int)Size[1]});
+			return;
+		}
+}
+
+void Slate::RefreshLayer(String const &Name)
+	{ RefreshLayer(Name, Region(GetOffset(), GetSize())); }
+
+void Slate::RefreshLayer(String const &Name, Region const &Area)
+{
+	Layer *Existing = FindLayer(Name);
+	assert(Existing != nullptr);
+	FlatVector const Start = Area.Start - GetOffset();
+	GdkRectangle Window = {(int)floorf(Start[0]), (int)floorf(Start[1]), 
+		(int)ceilf(Area.Size[0]) + 1, (int)ceilf(Area.Size[1]) + 1};
+	gdk_region_union_with_rect(Existing->Dirty.get(), &Window);
+	Recomposite(Window);
+}
+
+Slate::Layer *Slate::FindLayer(String const &Name)
+{
+	for (auto &Existing : Layers)
+		if (Existing.Name == Name) return &Existing;
+	return nullptr;
+}
+
+void Slate::Draw(Region const &Damage)
+{
+	if (DamageDrawHandler) DamageDrawHandler(Damage);
+	else if (DrawHandler) DrawHandler();
+
+	if (IsOffscreen()) // Drawn directly, since surfaces would rasterize vector targets
+		for (auto &Layer : Layers) Layer.Handler(Damage);
+}
+
+void Slate::Composite(cairo_t *Target)
+{
+	FlatVector const Size = GetSize(), Offset = GetOffset();
+	GdkRectangle const Everything = {0, 0, (int)Size[0], (int)Size[1]};
+	for (auto &Layer : Layers)
+	{
+		if (!Layer.Surface ||
+			(cairo_image_surface_get_width(Layer.Surface.get()) != Everything.width) ||
+			(cairo_image_surface_get_height(Layer.Surface.get()) != Everything.height))
+		{
+			Layer.Surface.reset(cairo_image_surface_create(CAIRO_FORMAT_ARGB32, Everything.width, Everything.height), 
+				cairo_surface_destroy);
+			Layer.Offset = Offset;
+			gdk_region_union_with_rect(Layer.Dirty.get(), &Everything);
+		}
+
+		// Scrolls shift the cached pixels, so only the strips scrolled in are drawn
+		FlatVector const Delta = Offset - Layer.Offset;
+		if ((Delta[0] != 0) || (Delta[1] != 0))
+		{
+			if ((Delta[0] == std::round(Delta[0])) && (Delta[1] == std::round(Delta[1])) &&
+				(std::abs(Delta[0]) < Everything.width) && (std::abs(Delta[1]) < Everything.height))
+				ScrollSurface(Layer.Surface.get(), Everything, Layer.Dirty.get(), Delta[0], Delta[1]);
+			else gdk_region_union_with_rect(Layer.Dirty.get(), &Everything);
+			Layer.Offset = Offset;
+		}
+
+		if (!gdk_region_empty(Layer.Dirty.get()))
+		{
+			GdkRectangle Bounds;
+			gdk_region_get_clipbox(Layer.Dirty.get(), &Bounds);
+			Region const Damage(FlatVector(Bounds.x, Bounds.y) + Offset, FlatVector(Bounds.width, Bounds.height));
+			DrawOnto(Layer.Surface.get(), Layer.Dirty.get(), [&Layer, &Damage](void) { Layer.Handler(Damage); });
+			Layer.Dirty.reset(gdk_region_new(), gdk_region_destroy);
+		}
+
+		cairo_set_source_surface(Target, Layer.Surface.get(), 0, 0);
+		cairo_paint(Target);
+	}
+}
 	
 void Slate::ClickEvent(FlatVector const &Cursor, bool LeftChanged, bool MiddleChanged, bool RightChanged)
 	{ if (ClickHandler) ClickHandler(Cursor, LeftChanged, MiddleChanged, RightChanged); }
@@ -487,8 +2353,24 @@ void Slate::ScrollEvent(FlatVector const &Cursor, int VerticalScroll, int Horizo
 void Slate::MoveEvent(FlatVector const &Cursor)
 	{ if (MoveHandler) MoveHandler(Cursor); }
 	
+void Slate::MoveHistoryEvent(std::vector<MotionSample> const &Samples)
+	{ if (MoveHistoryHandler) MoveHistoryHandler(Samples); }
+
 void Slate::EnterEvent(void)
 	{ if (EnterHandler) EnterHandler(); }
 	
 void Slate::LeaveEvent(void)
 	{ if (LeaveHandler) LeaveHandler(); }
+
+void Slate::ShapeClickEvent(std::vector<SpatialIndex::ShapeID> const &Hits, FlatVector const &Cursor,
+	bool LeftChanged, bool MiddleChanged, bool RightChanged)
+	{ if (ShapeClickHandler) ShapeClickHandler(Hits, Cursor, LeftChanged, MiddleChanged, RightChanged); }
+
+void Slate::ShapeMoveEvent(std::vector<SpatialIndex::ShapeID> const &Hits, FlatVector const &Cursor)
+	{ if (ShapeMoveHandler) ShapeMoveHandler(Hits, Cursor); }
+
+void Slate::ShapeEnterEvent(SpatialIndex::ShapeID Shape)
+	{ if (ShapeEnterHandler) ShapeEnterHandler(Shape); }
+
+void Slate::ShapeLeaveEvent(SpatialIndex::ShapeID Shape)
+	{ if (ShapeLeaveHandler) ShapeLeaveHandler(Shape); }
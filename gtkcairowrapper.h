@@ -2,48 +2,353 @@
 #define gtkcairowrapper_h
 
 #include <functional>
+#include <memory>
+#include <list>
+#include <map>
+#include <tuple>
+#include <ctime>
 
 #include "gtkwrapper.h"
 
 #include "../ren-general/rotation.h"
-#include "../ren-general/pool.h"
 #include "../ren-general/region.h"
 
 enum TextAlignment { taLeft, taMiddle, taFullMiddle, taRight };
 
+// Byte formats are unpremultiplied in memory order; float formats are 0 to 1
+enum PixelFormat { pfRGBA8, pfRGB8, pfGray8, pfGrayFloat, pfRGBAFloat };
+
+// Every: MoveEvent for each motion event
+// Compressed: MoveEvent with only the latest position, at most once per frame
+// History: MoveHistoryEvent with every position since the last delivery, at most once per frame, then
+// MoveEvent with the latest
+enum MotionMode { mmEvery, mmCompressed, mmHistory };
+
+struct MotionSample
+{
+	FlatVector Position;
+	unsigned int Time; // Milliseconds, server time from the event
+};
+
+// Bearing is the offset of the ink from the origin, which is on the baseline
+struct TextExtents
+{
+	FlatVector Size, Bearing;
+	float Advance, Ascent, Descent;
+};
+
+// Least recently used storage.  Each entry has a cost; once the summed cost exceeds the budget entries are
+// released from the cold end (the newest entry is always kept).
+template <typename KeyType, typename ValueType> class LRUCache
+{
+	public:
+		typedef std::function<void(ValueType &Value)> ReleaseHandler;
+
+		LRUCache(size_t Budget, ReleaseHandler const &Release) :
+			Budget(Budget), Cost(0), Evictions(0), Release(Release) {}
+		~LRUCache(void) { Clear(); }
+
+		ValueType *Find(KeyType const &Key)
+		{
+			auto Found = Index.find(Key);
+			if (Found == Index.end()) return nullptr;
+			Entries.splice(Entries.begin(), Entries, Found->second);
+			return &Found->second->Value;
+		}
+
+		void Add(KeyType const &Key, ValueType const &Value, size_t EntryCost)
+		{
+			Remove(Key);
+			Entries.push_front(Entry{Key, Value, EntryCost});
+			Index[Key] = Entries.begin();
+			Cost += EntryCost;
+			Trim();
+		}
+
+		void Remove(KeyType const &Key)
+		{
+			auto Found = Index.find(Key);
+			if (Found == Index.end()) return;
+			Drop(Found->second);
+		}
+
+		void Clear(void)
+			{ while (!Entries.empty()) Drop(--Entries.end()); }
+
+		void SetBudget(size_t NewBudget)
+			{ Budget = NewBudget; Trim(); }
+
+		size_t GetBudget(void) const { return Budget; }
+		size_t GetCost(void) const { return Cost; }
+		size_t Count(void) const { return Entries.size(); }
+		unsigned long GetEvictions(void) const { return Evictions; }
+		void ResetEvictions(void) { Evictions = 0; }
+
+	private:
+		struct Entry { KeyType Key; ValueType Value; size_t Cost; };
+		typedef typename std::list<Entry>::iterator EntryIterator;
+
+		void Drop(EntryIterator Dropee)
+		{
+			if (Release) Release(Dropee->Value);
+			Cost -= Dropee->Cost;
+			Index.erase(Dropee->Key);
+			Entries.erase(Dropee);
+		}
+
+		void Trim(void)
+		{
+			while ((Cost > Budget) && (Entries.size() > 1))
+			{
+				Drop(--Entries.end());
+				++Evictions;
+			}
+		}
+
+		size_t Budget, Cost;
+		unsigned long Evictions;
+		ReleaseHandler Release;
+		std::list<Entry> Entries;
+		std::map<KeyType, EntryIterator> Index;
+};
+
+// Uniform grid of shape bounds for hit testing.  Shapes added later are on top of earlier ones.  Shapes
+// are inserted in every cell they overlap, so the cell size should be near the size of a typical shape.
+class SpatialIndex
+{
+	public:
+		typedef unsigned int ShapeID;
+
+		SpatialIndex(float CellSize = 64);
+
+		void Add(ShapeID ID, Region const &Bounds); // Replaces and raises the shape if the ID exists
+		void Remove(ShapeID ID);
+		void Clear(void);
+		unsigned int Count(void) const;
+
+		// Topmost first
+		std::vector<ShapeID> Find(FlatVector const &Point) const;
+		std::vector<ShapeID> Find(Region const &Area) const;
+
+	private:
+		struct Shape
+		{
+			Region Bounds;
+			unsigned long Order;
+		};
+		typedef std::pair<int, int> Cell;
+
+		template <typename CellHandler> void ForCells(Region const &Area, CellHandler const &Handler) const;
+		std::vector<ShapeID> Sort(std::vector<ShapeID> &Hits) const;
+
+		float CellSize;
+		unsigned long NextOrder;
+		std::map<ShapeID, Shape> Shapes;
+		std::map<Cell, std::vector<ShapeID> > Cells;
+};
+
+// Process-wide decoded PNG storage used by VectorArea::DrawImage.  Entries are keyed by filename and
+// reloaded if the file's modification time or size changes.
+class ImageCache
+{
+	public:
+		struct Statistics
+		{
+			unsigned long Hits, Misses, Evictions;
+			size_t Bytes, Budget;
+			unsigned int Count;
+		};
+
+		static ImageCache &Instance(void);
+
+		void SetBudget(size_t Bytes);
+		void Clear(void);
+		Statistics GetStatistics(void) const;
+		void ResetStatistics(void);
+
+		// Returns a new reference (release with cairo_surface_destroy) or nullptr if the image can't be loaded
+		cairo_surface_t *Load(String const &Filename);
+		// As Load, but returns nullptr rather than decoding if the image isn't already cached
+		cairo_surface_t *Find(String const &Filename);
+
+	private:
+		ImageCache(void);
+
+		struct Image
+		{
+			cairo_surface_t *Surface; // Null if the file couldn't be decoded, so it isn't retried until it changes
+			time_t Modified;
+			long ModifiedNanoseconds; // Files can be rewritten within a second
+			long long Size;
+		};
+		LRUCache<String, Image> Images;
+		unsigned long Hits, Misses;
+		mutable std::mutex Mutex; // Loads happen on tile workers
+};
+
+// A path recorded once around the origin and drawn many times at different positions.  Build with cairo
+// path calls only (move_to, line_to, arc...), don't stroke or fill.
+class PathStamp
+{
+	public:
+		PathStamp(std::function<void(cairo_t *Context)> const &Build);
+		~PathStamp(void);
+		PathStamp(PathStamp const &) = delete;
+		PathStamp &operator=(PathStamp const &) = delete;
+
+		// Bounds of the path, not including stroke width
+		FlatVector const &GetStart(void) const;
+		FlatVector const &GetEnd(void) const;
+
+	private:
+		friend class VectorArea;
+		cairo_path_t *Path;
+		FlatVector Start, End;
+};
+
+// Printable ASCII from a monospace font rasterized once into an alpha surface, so grids of short changing
+// text (hex dumps, registers) are drawn by masking cells instead of shaping.  Proportional fonts overlap.
+class GlyphAtlas
+{
+	public:
+		GlyphAtlas(String const &Family = "monospace", unsigned int Size = 12);
+		~GlyphAtlas(void);
+		GlyphAtlas(GlyphAtlas const &) = delete;
+		GlyphAtlas &operator=(GlyphAtlas const &) = delete;
+
+		FlatVector const &GetCellSize(void) const;
+
+	private:
+		friend class VectorArea;
+		static const char FirstGlyph = ' ', LastGlyph = '~';
+		cairo_surface_t *Atlas;
+		cairo_surface_t *Glyphs[LastGlyph - FirstGlyph + 1]; // Views into the atlas
+		FlatVector CellSize;
+};
+
 class VectorArea;
-class FontData : public PoolItem<std::pair<int, VectorArea *>, FontData>
+struct DrawCommand;
+class DisplayList;
+// Get these from the FontCache.  Print only works within a VectorArea's Draw().
+class FontData : public std::enable_shared_from_this<FontData>
 {
 	public:
-		FontData(const std::pair<int, VectorArea *> &Data);
+		FontData(String const &Family, unsigned int Size, PangoWeight Weight, PangoStyle Style);
 		~FontData(void);
+		FontData(FontData const &) = delete;
+		FontData &operator=(FontData const &) = delete;
+
+		struct Metrics
+		{
+			float Ascent, Descent, Height, AverageWidth, DigitWidth;
+		};
+		Metrics const &GetMetrics(void) const;
 
 		void Print(String const &Text, TextAlignment Alignment, FlatVector const &Position);
 		void Print(String const &Text, TextAlignment Alignment, Region const &Limits, bool Wrap = false);
+
+		// Usable outside of Draw(), repeated measurements are cached
+		TextExtents MeasureText(String const &Text);
+
+		// Shaped layouts are kept between frames, keyed by text, width limit, alignment and wrapping
+		struct Statistics
+		{
+			unsigned long Hits, Misses, Evictions;
+			unsigned int Count, Capacity;
+		};
+		void SetLayoutCacheSize(unsigned int Capacity);
+		Statistics GetLayoutStatistics(void) const;
+		void ResetLayoutStatistics(void);
 	protected:
 		friend class VectorArea;
 		PangoFontDescription *PangoFont;
 
 	private:
-		VectorArea *Canvas;
+		Metrics FontMetrics;
+
+		typedef std::tuple<String, int, int, bool> LayoutKey; // Text, Pango width (-1 for none), alignment, wrap
+		LRUCache<LayoutKey, PangoLayout *> Layouts;
+		unsigned long Hits, Misses;
+
+		LRUCache<String, TextExtents> Measurements;
+
+		PangoLayout *GetLayout(cairo_t *Context, String const &Text);
+		PangoLayout *GetLayout(cairo_t *Context, String const &Text, float Width, TextAlignment Alignment, bool Wrap);
+		void Show(cairo_t *Context, DrawCommand const &Command, String const &Text);
 };
 
-typedef Access<FontData> Font;
+typedef std::shared_ptr<FontData> Font;
 
-class VectorArea : private Pool<std::pair<int, VectorArea *>, FontData> // Deprecated, use Slate below
+// Fonts shared by every VectorArea.  Past the capacity, the least recently requested fonts are dropped from
+// the cache; fonts still held elsewhere stay alive.
+class FontCache
+{
+	public:
+		static FontCache &Instance(void);
+
+		Font Get(String const &Family, unsigned int Size,
+			PangoWeight Weight = PANGO_WEIGHT_NORMAL, PangoStyle Style = PANGO_STYLE_NORMAL);
+
+		void SetCapacity(unsigned int Count);
+		void Clear(void);
+
+	private:
+		FontCache(void);
+
+		typedef std::tuple<String, unsigned int, int, int> FontKey; // Family, size, weight, style
+		LRUCache<FontKey, Font> Fonts;
+};
+
+class VectorArea // Deprecated, use Slate below
 {
 	public:
 		VectorArea(void);
+		VectorArea(FlatVector const &HeadlessSize); // No widget, for RenderTo only; needs no display
 		~VectorArea(void);
 		operator GtkWidget*(void);
 
+		// Refresh and RedrawArea are coalesced and drawn on the next frame
 		void Refresh(void);
-		void PartialRefresh(void);
+		void PartialRefresh(void); // Same as FlushRefresh
 		void RedrawArea(const FlatVector &Position, const FlatVector &Size);
+		void FlushRefresh(void); // Draws pending refreshes immediately
+		void SetMaximumFrameRate(float FramesPerSecond); // Defaults to 60, 0 for no limit
+		void SetMotionMode(MotionMode Mode); // Defaults to mmEvery
 
 		void RequestSize(const FlatVector &Size);
 		void SetBackgroundColor(const Color &NewColor);
 
+		// Keeps the last render in an image surface.  Draw() only reruns for areas passed to Refresh or
+		// RedrawArea (or after a resize); other exposes are copied from the surface.
+		void SetBackingStore(bool On);
+
+		// Tiled mode records Draw() on the GTK thread, then rasterizes the recording into TileSize square
+		// image surfaces on the shared WorkerPool and composites them.  Draw() itself is never run on a
+		// worker, so it and every VectorArea call in it need no locking; none of the VectorArea methods
+		// may be called from other threads.  Workers only touch the ImageCache and fonts, which are locked:
+		// image lookups briefly serialize on the cache, and text is drawn by one tile at a time, so views
+		// mostly of text gain little from tiling.  Drawing directly on GetContext() isn't recorded.
+		void SetTiled(bool On, unsigned int TileSize = 256);
+
+		// DrawImage skips images that aren't decoded yet, decodes them on the ImageLoader threads and
+		// refreshes once they're ready, rather than decoding in Draw()
+		void SetAsynchronousImages(bool On);
+
+		// For canvases larger than the widget (see CanvasScroller's virtual mode): Draw() is translated by
+		// -Offset and gets its damage in canvas coordinates, as are shapes.  Event positions stay in widget
+		// coordinates.
+		// RenderTo ignores the offset.  Whole pixel changes shift what's on screen (and in the backing
+		// store) and only draw the newly exposed strips.
+		void SetOffset(FlatVector const &Offset);
+		FlatVector GetOffset(void) const;
+
+		// Runs Draw() on any cairo surface (image, SVG, PDF...) at the given size, with GetSize() returning
+		// that size meanwhile.  Nothing is painted under Draw().  Returns false if cairo reports an error.
+		bool RenderTo(cairo_surface_t *Target, FlatVector const &Size);
+		bool SavePNG(String const &Filename, FlatVector const &Size);
+		bool SaveSVG(String const &Filename, FlatVector const &Size);
+		bool SavePDF(String const &Filename, FlatVector const &Size);
+
 		// Cairo tools - valid only within Draw()
 		void Translate(const FlatVector &Translation);
 		void SetColor(const Color &NewColor);
@@ -54,53 +359,186 @@ class VectorArea : private Pool<std::pair<int, VectorArea *>, FontData> // Depre
 
 		void SetFontSize(unsigned int NewSize);
 		float GetTextWidth(const String &Text);
+		TextExtents MeasureText(String const &Text); // Uses the current font size
+		static TextExtents MeasureText(String const &Text, unsigned int Size); // Usable anywhere, results are cached
 		void PrintNumber(float Number, TextAlignment Alignment, const FlatVector &Position);
 		void PrintHex(unsigned int Number, TextAlignment Alignment, const FlatVector &Position);
 		void Print(const String &Text, TextAlignment Alignment, const FlatVector &Position);
 		void Print(const String &Text, const FlatVector &Alignment, const FlatVector &Position);
+
+		// Atlas text in the current color; Position is the top left of the first cell.  Characters outside
+		// printable ASCII are left blank.
+		void DrawGlyphs(std::shared_ptr<GlyphAtlas const> const &Atlas, FlatVector const &Position, String const &Text);
+		void DrawHexGlyphs(std::shared_ptr<GlyphAtlas const> const &Atlas, FlatVector const &Position,
+			unsigned int Number, unsigned int Digits); // Zero padded
+		void DrawNumberGlyphs(std::shared_ptr<GlyphAtlas const> const &Atlas, FlatVector const &Position, int Number);
+
 		void DrawLine(const FlatVector &Start, const FlatVector &End);
 
 		void DrawRectangle(const FlatVector &Start, const FlatVector &Size);
 		void DrawRoundedRectangle(const FlatVector &Start, const FlatVector &Size);
+		void DrawStamp(std::shared_ptr<PathStamp const> const &Stamp, FlatVector const &Position); // Fills or strokes
 		void DrawCircle(const FlatVector &Position, float Radius);
 		void DrawArc(const FlatVector &Position, float Radius, float AngleStart, float AngleEnd);
 
+		// Batches - each call is one path and one stroke or fill, use these for large numbers of shapes
+		void DrawLines(FlatVector const *Points, unsigned int Count); // Count start, end pairs
+		void DrawPolyline(FlatVector const *Points, unsigned int Count); // Filled as a polygon if fill is on
+		void DrawRectangles(FlatVector const *Rectangles, unsigned int Count); // Count start, size pairs
+		void DrawCircles(FlatVector const *Positions, unsigned int Count, float Radius);
+
+		// A stroked line through evenly spaced samples.  Visible is the range of sample indices spread across
+		// Target's width and Values the range spread up its height.  Each pixel column is reduced to its
+		// first, minimum, maximum and last samples, so the cost follows the width rather than the count.
+		void DrawSeries(float const *Samples, unsigned int Count, RangeF const &Visible, RangeF const &Values,
+			Region const &Target);
+
 		void DrawImage(const String &Filename, const FlatVector &Position, bool Centered = true);
 		void DrawImage(const String &Filename, const FlatVector &Position, Angle Rotation);
 
+		// Converts to cairo's format during the call, so the buffer may be released afterwards.  Stride is in
+		// bytes.  The pixels are scaled to fill Target, interpolated if Smooth.
+		void DrawPixels(void const *Pixels, PixelFormat Format, unsigned int Width, unsigned int Height,
+			unsigned int Stride, Region const &Target, bool Smooth = false);
+
 		// Pango text stuff - above is toy api
-		Font *GetFont(int Size);
+		Font *GetFont(int Size); // Sans at the size, delete the result; prefer FontCache
 
 		// Queries
 		FlatVector GetSize(void);
 
+		// Shapes registered here are hit tested for the Shape events, in the coordinates Draw() uses (canvas
+		// coordinates with an offset, see SetOffset)
+		SpatialIndex &GetShapes(void);
+
+		// Primitives entirely outside the area being drawn are skipped before reaching cairo
+		struct DrawStatistics
+		{
+			unsigned long Drawn, Culled;
+		};
+		DrawStatistics GetDrawStatistics(void) const;
+		void ResetDrawStatistics(void);
+
 	protected:
 		virtual void ResizeEvent(FlatVector const &NewSize);
 
 		virtual void Draw(void);
+		// Damage is the area being drawn (all of it while retained or tiled drawing is recorded); calls Draw()
+		virtual void Draw(Region const &Damage);
 
 		virtual void ClickEvent(FlatVector const &Cursor, bool LeftChanged, bool MiddleChanged, bool RightChanged);
 		virtual void DeclickEvent(FlatVector const &Cursor, bool LeftChanged, bool MiddleChanged, bool RightChanged);
 		virtual void ScrollEvent(FlatVector const &Cursor, int VerticalScroll, int HorizontalScroll);
 		virtual void MoveEvent(FlatVector const &Cursor);
+		virtual void MoveHistoryEvent(std::vector<MotionSample> const &Samples);
 		virtual void EnterEvent(void);
 		virtual void LeaveEvent(void);
 
+		// Only sent when the cursor is over at least one shape; hits are topmost first
+		virtual void ShapeClickEvent(std::vector<SpatialIndex::ShapeID> const &Hits, FlatVector const &Cursor,
+			bool LeftChanged, bool MiddleChanged, bool RightChanged);
+		virtual void ShapeMoveEvent(std::vector<SpatialIndex::ShapeID> const &Hits, FlatVector const &Cursor);
+		// For the topmost shape under the cursor
+		virtual void ShapeEnterEvent(SpatialIndex::ShapeID Shape);
+		virtual void ShapeLeaveEvent(SpatialIndex::ShapeID Shape);
+
 		bool Left, Middle, Right;
 
 		friend class FontData;
 		cairo_t *GetContext(void);
 
+		// For caching layers.  Composite runs after Draw() or its replay for each area rendered to the
+		// window (not within RenderTo), in window coordinates.  Recomposite repaints a window area without
+		// discarding the retained recording.
+		virtual void Composite(cairo_t *Target);
+		void Recomposite(GdkRectangle const &Area);
+		// Runs Body with drawing redirected to Target, a window sized image surface, translated like Draw().
+		// Only Area (window coordinates) is cleared and drawn; drawing state starts from the defaults.
+		void DrawOnto(cairo_surface_t *Target, GdkRegion const *Area, std::function<void(void)> const &Body);
+		// Moves the pixels of a window sized surface (which may be null) for a scroll by Delta, moving Damage
+		// with them and adding the strips scrolled in
+		static void ScrollSurface(cairo_surface_t *Surface, GdkRectangle const &Bounds, GdkRegion *Damage,
+			int DeltaX, int DeltaY);
+		bool IsOffscreen(void) const; // Within RenderTo, where caches would rasterize vector targets
+
+		// Retained mode records Draw() into a display list; exposes replay only the commands touching the
+		// damage.  The recording is redone after Refresh or a resize; RedrawArea only replays it, so call
+		// Refresh when Draw() would draw something different.  With an offset (see SetOffset) it also
+		// covers a view's worth around what's shown, and scrolls within that replay it.  Drawing done
+		// directly on GetContext() isn't recorded and disappears on the next replay.
+		void SetRetained(bool On);
+
 	private:
-		GtkWidget *Data;
+		VectorArea(GtkWidget *Data);
+
+		GtkWidget *Data; // Null if headless
+
+		bool Offscreen; // True within RenderTo
+		FlatVector OffscreenSize; // For headless areas and RenderTo
 
 		bool FillOn;
 		float Roundedness;
+		float LineWidth;
+		unsigned int FontSize;
+		FlatVector Offset; // Sum of Translate calls, for bounding commands in device space
+		FlatVector ScrollOffset;
+		float Clip[4]; // Device space bounds of the area being drawn, for culling
+		DrawStatistics Counts;
 
 		cairo_t *CairoContext; // Valid only within draw function
-		bool ShouldPartialRefresh;
+		static thread_local VectorArea *Active; // The area in Render(), for fonts
+
+		DisplayList *Retained;
+		DisplayList *Exposing; // Tiled recording shared by the parts of one RenderDamage without Retained
+		FlatVector RecordedStart, RecordedEnd; // Draw() coordinates covered by the retained recording
+		DisplayList *Recorder; // Non-null while recording Draw()
+
+		cairo_surface_t *Store;
+		GdkRegion *StoreDamage; // Non-null if the backing store is on
+
+		FrameScheduler Frames;
+
+		unsigned int TileSize; // 0 if not tiled
+
+		bool AsynchronousImages;
+		std::map<String, ImageLoader::RequestID> ImageRequests;
+		std::vector<String> MissedImages; // Evicted while rendering, to request again afterwards
+		std::map<String, time_t> FailedImages; // Modification times of files that couldn't be decoded
+		cairo_surface_t *GetImage(String const &Filename);
+
+		SpatialIndex Shapes;
+		bool Hovering;
+		SpatialIndex::ShapeID Hovered;
+		void UpdateHover(std::vector<SpatialIndex::ShapeID> const &Hits);
 
-		void DrawInternal(int X, int Y, int Width, int Height);
+		MotionMode Motion;
+		std::vector<MotionSample> MotionSamples; // Waiting for delivery
+		gint64 LastMotion; // Microseconds
+		guint MotionTimerID;
+		void DeliverMotion(FlatVector const &Cursor);
+		static gboolean MotionTimeHandler(VectorArea *This);
+
+		void Bound(DrawCommand &Command, FlatVector const &Start, FlatVector const &End, float Padding);
+		bool IsCulled(DrawCommand const &Command) const; // Outside the clip in immediate mode
+		void SubmitText(String const &Text, FlatVector const &Start, TextExtents const &Extents);
+		void SubmitBatch(DrawCommand &Command, FlatVector const *Points, float Padding);
+		void Submit(DrawCommand const &Command, String const *Text = nullptr, FontData *Font = nullptr,
+			FlatVector const *Points = nullptr, std::shared_ptr<PathStamp const> const *Stamp = nullptr,
+			std::shared_ptr<GlyphAtlas const> const *Atlas = nullptr,
+			std::shared_ptr<cairo_surface_t> const *Surface = nullptr);
+		// With MissedImages, images not in the ImageCache are skipped and listed there rather than decoded
+		static void Execute(cairo_t *Context, DrawCommand const &Command, String const *Text, FontData *Font,
+			FlatVector const *Points = nullptr, PathStamp const *Stamp = nullptr, GlyphAtlas const *Atlas = nullptr,
+			cairo_surface_t *Surface = nullptr, std::vector<String> *MissedImages = nullptr);
+		static void Replay(cairo_t *Context, DisplayList const &List, float const *Clip, DrawStatistics &Counts,
+			std::vector<String> *MissedImages);
+		void RenderTiles(cairo_t *Target, DisplayList const &List, FlatVector const &Scroll, int X, int Y, int Width, int Height);
+
+		void Damage(GdkRectangle const &Area, bool Rerecord); // Rerecord drops the retained recording
+		void Render(cairo_t *Target, int X, int Y, int Width, int Height);
+		void ScrollStore(int DeltaX, int DeltaY);
+		void RenderDamage(cairo_t *Target, GdkRegion const *Damage);
+		void DrawInternal(GdkRegion const *Exposed);
 		static gboolean ResizeHandler(GtkWidget *, GdkEventConfigure *, VectorArea *This);
 		static gboolean DrawHandler(GtkWidget *, GdkEventExpose *Event, VectorArea *This);
 		static gboolean ClickHandler(GtkWidget *, GdkEventButton *Event, VectorArea *This);
@@ -116,33 +554,80 @@ class Slate : public VectorArea
 	private:
 		std::function<void (FlatVector const &NewSize)> ResizeHandler;
 		std::function<void (void)> DrawHandler;
+		std::function<void (Region const &Damage)> DamageDrawHandler;
 		std::function<void (FlatVector const &Cursor, bool LeftChanged, bool MiddleChanged, bool RightChanged)> ClickHandler;
 		std::function<void (FlatVector const &Cursor, bool LeftChanged, bool MiddleChanged, bool RightChanged)> DeclickHandler;
 		std::function<void (FlatVector const &Cursor, int VerticalScroll, int HorizontalScroll)> ScrollHandler;
 		std::function<void (FlatVector const &Cursor)> MoveHandler;
+		std::function<void (std::vector<MotionSample> const &Samples)> MoveHistoryHandler;
 		std::function<void (void)> EnterHandler;
 		std::function<void (void)> LeaveHandler;
+		std::function<void (std::vector<SpatialIndex::ShapeID> const &Hits, FlatVector const &Cursor, bool LeftChanged, bool MiddleChanged, bool RightChanged)> ShapeClickHandler;
+		std::function<void (std::vector<SpatialIndex::ShapeID> const &Hits, FlatVector const &Cursor)> ShapeMoveHandler;
+		std::function<void (SpatialIndex::ShapeID Shape)> ShapeEnterHandler;
+		std::function<void (SpatialIndex::ShapeID Shape)> ShapeLeaveHandler;
+
+		struct Layer
+		{
+			String Name;
+			std::function<void (Region const &Damage)> Handler;
+			std::shared_ptr<cairo_surface_t> Surface;
+			FlatVector Offset; // The scroll offset Surface was drawn at
+			std::shared_ptr<GdkRegion> Dirty; // Window coordinates
+		};
+		std::vector<Layer> Layers;
+		Layer *FindLayer(String const &Name);
 	
 	public:
 		// Construction
+		Slate(void);
+		Slate(FlatVector const &HeadlessSize); // See VectorArea::RenderTo
+
 		void SetResizeHandler(decltype(ResizeHandler) const &Handler);
 		void SetDrawHandler(decltype(DrawHandler) const &Handler);
+		void SetDamageDrawHandler(decltype(DamageDrawHandler) const &Handler); // Used instead of the draw handler if set
 		void SetClickHandler(decltype(ClickHandler) const &Handler);
 		void SetDeclickHandler(decltype(DeclickHandler) const &Handler);
 		void SetScrollHandler(decltype(ScrollHandler) const &Handler);
 		void SetMoveHandler(decltype(MoveHandler) const &Handler);
+		void SetMoveHistoryHandler(decltype(MoveHistoryHandler) const &Handler); // For mmHistory
 		void SetEnterHandler(decltype(EnterHandler) const &Handler);
 		void SetLeaveHandler(decltype(LeaveHandler) const &Handler);
+		void SetShapeClickHandler(decltype(ShapeClickHandler) const &Handler);
+		void SetShapeMoveHandler(decltype(ShapeMoveHandler) const &Handler);
+		void SetShapeEnterHandler(decltype(ShapeEnterHandler) const &Handler);
+		void SetShapeLeaveHandler(decltype(ShapeLeaveHandler) const &Handler);
+
+		// Draw calls are recorded with their bounds and replayed only where the window is damaged
+		void SetRetained(bool On);
+
+		// Layers are drawn bottom up in the order added, over the draw handler.  Each is kept in its own
+		// surface; only the areas passed to RefreshLayer (or exposed by a resize or scroll) are redrawn, and
+		// other exposes just composite the surfaces.  The handler gets the damage in Draw() coordinates.
+		// Refreshing a layer repaints that area from the retained recording or, without one, by rerunning
+		// the draw handler there, so anything that should stay cached belongs in a layer.  Adding an
+		// existing name replaces its handler.
+		void AddLayer(String const &Name, std::function<void (Region const &Damage)> const &Handler);
+		void RemoveLayer(String const &Name);
+		void RefreshLayer(String const &Name);
+		void RefreshLayer(String const &Name, Region const &Area); // Area in Draw() coordinates
 		
 	private:
 		void ResizeEvent(FlatVector const &NewSize);
-		void Draw(void);
+		void Draw(Region const &Damage);
+		void Composite(cairo_t *Target);
 		void ClickEvent(FlatVector const &Cursor, bool LeftChanged, bool MiddleChanged, bool RightChanged);
 		void DeclickEvent(FlatVector const &Cursor, bool LeftChanged, bool MiddleChanged, bool RightChanged);
 		void ScrollEvent(FlatVector const &Cursor, int VerticalScroll, int HorizontalScroll);
 		void MoveEvent(FlatVector const &Cursor);
+		void MoveHistoryEvent(std::vector<MotionSample> const &Samples);
 		void EnterEvent(void);
 		void LeaveEvent(void);
+		void ShapeClickEvent(std::vector<SpatialIndex::ShapeID> const &Hits, FlatVector const &Cursor,
+			bool LeftChanged, bool MiddleChanged, bool RightChanged);
+		void ShapeMoveEvent(std::vector<SpatialIndex::ShapeID> const &Hits, FlatVector const &Cursor);
+		void ShapeEnterEvent(SpatialIndex::ShapeID Shape);
+		void ShapeLeaveEvent(SpatialIndex::ShapeID Shape);
 };
 
 #endif
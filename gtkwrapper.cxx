@@ -3,6 +3,7 @@
 #include "../ren-general/region.h"
 #include "../ren-general/range.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
@@ -131,6 +132,203 @@ unsigned int TimedEvent::GetTimerPeriod(void) const
 gboolean TimedEvent::TimeHandler(TimedEvent *This)
 	{ This->Handler(); return TRUE; }
 
+FrameScheduler::FrameScheduler(GtkWidget *Data, float MaximumRate) :
+	Data(Data), Damage(gdk_region_new()), Period(0), LastFrame(0), TimerID(0)
+	{ SetMaximumRate(MaximumRate); }
+
+FrameScheduler::~FrameScheduler(void)
+{
+	if (TimerID != 0) g_source_remove(TimerID);
+	gdk_region_destroy(Damage);
+}
+
+void FrameScheduler::SetMaximumRate(float FramesPerSecond)
+	{ Period = (FramesPerSecond <= 0) ? 0 : (gint64)(1000000.0f / FramesPerSecond); }
+
+gint64 FrameScheduler::GetPeriod(void) const
+	{ return Period; }
+
+void FrameScheduler::Invalidate(void)
+{
+	const GdkRectangle Everything = {0, 0, Data->allocation.width, Data->allocation.height};
+	Invalidate(Everything);
+}
+
+void FrameScheduler::Invalidate(GdkRectangle const &Area)
+{
+	gdk_region_union_with_rect(Damage, &Area);
+	Schedule();
+}
+
+void FrameScheduler::Flush(void)
+{
+	if (TimerID != 0)
+	{
+		g_source_remove(TimerID);
+		TimerID = 0;
+	}
+	if (gdk_region_empty(Damage)) return;
+	if (!GDK_IS_WINDOW(Data->window)) return; // Keep the damage until there's something to draw on
+
+	gdk_window_invalidate_region(Data->window, Damage, false);
+	gdk_region_destroy(Damage);
+	Damage = gdk_region_new();
+
+	gdk_window_process_updates(Data->window, false);
+	LastFrame = g_get_monotonic_time();
+}
+
+void FrameScheduler::Schedule(void)
+{
+	if (TimerID != 0) return;
+	gint64 const Wait = std::max((gint64)0, LastFrame + Period - g_get_monotonic_time());
+	TimerID = g_timeout_add_full(GDK_PRIORITY_REDRAW, Wait / 1000, (GSourceFunc)FrameHandler, this, nullptr);
+}
+
+gboolean FrameScheduler::FrameHandler(FrameScheduler *This)
+{
+	This->TimerID = 0;
+	This->Flush();
+	return FALSE;
+}
+
+WorkerPool::WorkerPool(unsigned int ThreadCount) :
+	Quit(false)
+{
+	if (ThreadCount == 0) ThreadCount = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned int Index = 0; Index < ThreadCount; ++Index)
+		Threads.push_back(std::thread(&WorkerPool::Work, this));
+}
+
+WorkerPool::~WorkerPool(void)
+{
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		Quit = true;
+	}
+	Wake.notify_all();
+	for (auto &Thread : Threads) Thread.join();
+}
+
+WorkerPool &WorkerPool::Shared(void)
+{
+	static WorkerPool Out;
+	return Out;
+}
+
+unsigned int WorkerPool::GetThreadCount(void) const
+	{ return Threads.size(); }
+
+void WorkerPool::Add(ActionHandler const &Job)
+{
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		Jobs.push_back(Job);
+	}
+	Wake.notify_one();
+}
+
+void WorkerPool::Run(std::vector<ActionHandler> const &Batch)
+{
+	unsigned int Remaining = Batch.size();
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		for (auto &Job : Batch)
+			Jobs.push_back([this, &Job, &Remaining](void)
+			{
+				Job();
+				std::lock_guard<std::mutex> Lock(Mutex);
+				if (--Remaining == 0) Finished.notify_all();
+			});
+	}
+	Wake.notify_all();
+
+	std::unique_lock<std::mutex> Lock(Mutex);
+	Finished.wait(Lock, [&Remaining](void) { return Remaining == 0; });
+}
+
+void WorkerPool::Work(void)
+{
+	while (true)
+	{
+		ActionHandler Job;
+		{
+			std::unique_lock<std::mutex> Lock(Mutex);
+			Wake.wait(Lock, [this](void) { return Quit || !Jobs.empty(); });
+			if (Jobs.empty()) return;
+			Job = Jobs.front();
+			Jobs.pop_front();
+		}
+		Job();
+	}
+}
+
+ImageLoader::ImageLoader(void) : NextID(0), Decoders(std::max(2u, std::thread::hardware_concurrency() / 2)) {}
+
+ImageLoader &ImageLoader::Instance(void)
+{
+	static ImageLoader Out;
+	return Out;
+}
+
+ImageLoader::RequestID ImageLoader::Queue(ActionHandler const &Work, ActionHandler const &Done)
+{
+	RequestID Request;
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		Request = NextID++;
+		Pending[Request] = Done;
+	}
+	Decoders.Add([this, Request, Work](void)
+	{
+		{
+			std::lock_guard<std::mutex> Lock(Mutex);
+			if (Pending.find(Request) == Pending.end()) return; // Cancelled while waiting
+		}
+		Work();
+		g_idle_add(Deliver, new std::pair<ImageLoader *, RequestID>(this, Request));
+	});
+	return Request;
+}
+
+ImageLoader::RequestID ImageLoader::Load(String const &Filename, std::function<void(GdkPixbuf *Image)> const &Handler)
+{
+	// Whichever of the job and the handler goes last releases the image, so cancelled loads don't leak
+	auto Result = std::make_shared<std::shared_ptr<GdkPixbuf>>();
+	return Queue(
+		[Filename, Result](void)
+		{
+			GdkPixbuf *Image = gdk_pixbuf_new_from_file(Filename.c_str(), nullptr);
+			if (Image != nullptr) Result->reset(Image, [](GdkPixbuf *Image) { g_object_unref(Image); });
+		},
+		[Handler, Result](void) { Handler(Result->get()); });
+}
+
+void ImageLoader::Cancel(RequestID Request)
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	Pending.erase(Request);
+}
+
+gboolean ImageLoader::Deliver(gpointer Data)
+{
+	auto *Delivery = static_cast<std::pair<ImageLoader *, RequestID> *>(Data);
+	ImageLoader &This = *Delivery->first;
+	ActionHandler Done;
+	{
+		std::lock_guard<std::mutex> Lock(This.Mutex);
+		auto Found = This.Pending.find(Delivery->second);
+		if (Found != This.Pending.end())
+		{
+			Done = Found->second;
+			This.Pending.erase(Found);
+		}
+	}
+	delete Delivery;
+	if (Done) Done();
+	return false;
+}
+
 ///////////////////////////////////////////////////////////
 // Widget extensions
 KeyboardWidget::KeyboardWidget(GtkWidget *Data) :
@@ -540,17 +738,52 @@ void Scroller::ShowRange(float Start, float End)
 }
 
 // A 2D scroller for only what must necessarily be scrolled in 2D
-CanvasScroller::CanvasScroller(void) : Widget(gtk_scrolled_window_new(nullptr, nullptr)),
+CanvasScroller::CanvasScroller(void) : CanvasScroller(false) {}
+
+CanvasScroller::CanvasScroller(bool Virtual) : 
+	Widget(Virtual ? gtk_table_new(2, 2, false) : gtk_scrolled_window_new(nullptr, nullptr)),
+	Virtual(Virtual),
 	InitialAdjustmentCompleted(false),
 	HorizontalAdjustment(nullptr), VerticalAdjustment(nullptr),
 	HorizontalScrollHandler(-1), VerticalScrollHandler(-1)
 { 
-	gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(Data), GTK_POLICY_ALWAYS, GTK_POLICY_ALWAYS); 
 	g_signal_connect(G_OBJECT(Data), "map", G_CALLBACK(InitialStateChangeHandler), this);
+	if (!Virtual)
+	{
+		gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(Data), GTK_POLICY_ALWAYS, GTK_POLICY_ALWAYS); 
+		return;
+	}
+
+	// Our own adjustments and scrollbars, since a scrolled window would want to move the child
+	HorizontalAdjustment = GTK_ADJUSTMENT(gtk_adjustment_new(0, 0, 0, 16, 0, 0));
+	VerticalAdjustment = GTK_ADJUSTMENT(gtk_adjustment_new(0, 0, 0, 16, 0, 0));
+	GtkWidget 
+		*HorizontalBar = gtk_hscrollbar_new(HorizontalAdjustment), 
+		*VerticalBar = gtk_vscrollbar_new(VerticalAdjustment);
+	gtk_table_attach(GTK_TABLE(Data), VerticalBar, 1, 2, 0, 1, 
+		GTK_FILL, (GtkAttachOptions)(GTK_EXPAND | GTK_FILL), 0, 0);
+	gtk_table_attach(GTK_TABLE(Data), HorizontalBar, 0, 1, 1, 2, 
+		(GtkAttachOptions)(GTK_EXPAND | GTK_FILL), GTK_FILL, 0, 0);
+	gtk_widget_show(HorizontalBar);
+	gtk_widget_show(VerticalBar);
+
+	g_signal_connect(G_OBJECT(HorizontalAdjustment), "changed", G_CALLBACK(InitialStateChangeHandler), this);
+	HorizontalScrollHandler = g_signal_connect(G_OBJECT(HorizontalAdjustment), "value-changed", G_CALLBACK(ScrollHandler), this);
+	VerticalScrollHandler = g_signal_connect(G_OBJECT(VerticalAdjustment), "value-changed", G_CALLBACK(ScrollHandler), this);
+	g_signal_connect(G_OBJECT(Data), "scroll-event", G_CALLBACK(WheelHandler), this);
 }
 
 void CanvasScroller::Set(GtkWidget *Settee)
 {
+	if (Virtual)
+	{
+		gtk_table_attach(GTK_TABLE(Data), Settee, 0, 1, 0, 1, 
+			(GtkAttachOptions)(GTK_EXPAND | GTK_FILL), (GtkAttachOptions)(GTK_EXPAND | GTK_FILL), 0, 0);
+		g_signal_connect(G_OBJECT(Settee), "size-allocate", G_CALLBACK(ViewResizeHandler), this);
+		gtk_widget_show(Settee);
+		return;
+	}
+	
 	gtk_scrolled_window_add_with_viewport(GTK_SCROLLED_WINDOW(Data), Settee);
 	
 	HorizontalAdjustment = gtk_scrolled_window_get_hadjustment(GTK_SCROLLED_WINDOW(Data));
@@ -567,6 +800,25 @@ void CanvasScroller::Set(GtkWidget *Settee)
 	gtk_widget_show(Settee);
 }
 
+void CanvasScroller::SetLogicalSize(FlatVector const &Size)
+{
+	assert(Virtual);
+	gtk_adjustment_set_upper(HorizontalAdjustment, Size[0]);
+	gtk_adjustment_set_upper(VerticalAdjustment, Size[1]);
+	gtk_adjustment_changed(HorizontalAdjustment);
+	gtk_adjustment_changed(VerticalAdjustment);
+	Nudge(FlatVector(0, 0)); // Reclamp the position to the new size
+}
+
+void CanvasScroller::SetOffsetHandler(std::function<void(FlatVector const &Offset)> const &Handler)
+	{ OffsetHandler = Handler; }
+
+FlatVector CanvasScroller::GetOffset(void) const
+{
+	if (VerticalAdjustment == nullptr) return FlatVector(0, 0);
+	return FlatVector(gtk_adjustment_get_value(HorizontalAdjustment), gtk_adjustment_get_value(VerticalAdjustment));
+}
+
 void CanvasScroller::ShowRange(FlatVector Start, FlatVector End)
 {
 	assert(VerticalAdjustment != nullptr);
@@ -673,6 +925,36 @@ void CanvasScroller::DoInitialAdjustment(void)
 void CanvasScroller::InitialStateChangeHandler(void *, CanvasScroller *This)
 	{ This->DoInitialAdjustment(); }
 
+void CanvasScroller::ScrollHandler(GtkAdjustment *, CanvasScroller *This)
+	{ if (This->OffsetHandler) This->OffsetHandler(This->GetOffset()); }
+
+void CanvasScroller::ViewResizeHandler(GtkWidget *, GtkAllocation *Allocation, CanvasScroller *This)
+{
+	gtk_adjustment_set_page_size(This->HorizontalAdjustment, Allocation->width);
+	gtk_adjustment_set_page_increment(This->HorizontalAdjustment, Allocation->width * 0.9f);
+	gtk_adjustment_set_page_size(This->VerticalAdjustment, Allocation->height);
+	gtk_adjustment_set_page_increment(This->VerticalAdjustment, Allocation->height * 0.9f);
+	gtk_adjustment_changed(This->HorizontalAdjustment);
+	gtk_adjustment_changed(This->VerticalAdjustment);
+	This->Nudge(FlatVector(0, 0));
+}
+
+gboolean CanvasScroller::WheelHandler(GtkWidget *, GdkEventScroll *Event, CanvasScroller *This)
+{
+	float const 
+		Horizontal = gtk_adjustment_get_step_increment(This->HorizontalAdjustment) * 3,
+		Vertical = gtk_adjustment_get_step_increment(This->VerticalAdjustment) * 3;
+	switch (Event->direction)
+	{
+		case GDK_SCROLL_UP: This->Nudge(FlatVector(0, -Vertical)); break;
+		case GDK_SCROLL_DOWN: This->Nudge(FlatVector(0, Vertical)); break;
+		case GDK_SCROLL_LEFT: This->Nudge(FlatVector(-Horizontal, 0)); break;
+		case GDK_SCROLL_RIGHT: This->Nudge(FlatVector(Horizontal, 0)); break;
+		default: return false;
+	}
+	return true;
+}
+
 
 ///////////////////////////////////////////////////////////
 // Label wrapper
@@ -737,8 +1019,16 @@ void BlockLabel::SetText(const String &NewText)
 	{ gtk_label_set_text(GTK_LABEL(Data), NewText.c_str()); }
 
 // Sticker, an image
-Sticker::Sticker(const String &Filename) : Widget(gtk_image_new_from_file(Filename.c_str()))
-	{}
+Sticker::Sticker(const String &Filename) : Widget(gtk_image_new_from_stock(GTK_STOCK_MISSING_IMAGE, GTK_ICON_SIZE_BUTTON))
+{
+	GtkWidget *Image = Data;
+	ImageLoader::RequestID const Request = ImageLoader::Instance().Load(Filename, [Image](GdkPixbuf *Decoded)
+		{ if (Decoded != nullptr) gtk_image_set_from_pixbuf(GTK_IMAGE(Image), Decoded); });
+	g_signal_connect(G_OBJECT(Data), "destroy", G_CALLBACK(CancelHandler), GUINT_TO_POINTER(Request));
+}
+
+void Sticker::CancelHandler(GtkWidget *, gpointer Request)
+	{ ImageLoader::Instance().Cancel(GPOINTER_TO_UINT(Request)); }
 
 // Article - a long, wrapped, bordered(?), scrollbarred label
 Article::Article(const String &Text) : Widget(gtk_text_view_new())
@@ -1109,6 +1399,78 @@ void List::Remove(int Item)
 	Added--;
 }
 
+int List::Add(std::vector<String> const &NewStrings)
+{
+	int const Selection = GetSelection();
+	DetachModel();
+	for (auto &NewString : NewStrings)
+		gtk_list_store_insert_with_values(Store, nullptr, -1, 0, NewString.c_str(), 1, true, -1);
+	AttachModel(Selection);
+
+	int const First = Added;
+	Added += NewStrings.size();
+	return First;
+}
+
+void List::Remove(std::vector<int> Items)
+{
+	std::sort(Items.begin(), Items.end());
+	Items.erase(std::unique(Items.begin(), Items.end()), Items.end());
+	if (Items.empty()) return;
+
+	int Selection = GetSelection();
+	bool const Deselected = std::binary_search(Items.begin(), Items.end(), Selection);
+	if (Deselected) Selection = -1;
+	else if (Selection >= 0) Selection -= std::lower_bound(Items.begin(), Items.end(), Selection) - Items.begin();
+
+	DetachModel();
+	for (auto Item = Items.rbegin(); Item != Items.rend(); ++Item) // Last first so indices stay put
+	{
+		GtkTreeIter Iterator;
+		bool Result = gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(Store), &Iterator, nullptr, *Item); assert(Result);
+		gtk_list_store_remove(Store, &Iterator);
+	}
+	Added -= Items.size();
+	AttachModel(Selection);
+	if (Deselected && Handler) Handler();
+}
+
+void List::Reorder(std::vector<int> const &NewOrder)
+{
+	// One rows-reordered signal, and the view keeps the selection on its row, so no need to detach
+	assert((int)NewOrder.size() == Added);
+	if (NewOrder.empty()) return;
+	gtk_list_store_reorder(Store, const_cast<int *>(&NewOrder[0]));
+}
+
+void List::DetachModel(void)
+{
+	// Dropping the filter too, so it doesn't process every change either
+	g_signal_handler_block(G_OBJECT(ListData), ConnectionID);
+	GtkTreeModel *FilteredModel;
+	if (Multiline)
+	{
+		FilteredModel = gtk_tree_view_get_model(GTK_TREE_VIEW(ListData));
+		gtk_tree_view_set_model(GTK_TREE_VIEW(ListData), nullptr);
+	}
+	else
+	{
+		FilteredModel = gtk_combo_box_get_model(GTK_COMBO_BOX(ListData));
+		gtk_combo_box_set_model(GTK_COMBO_BOX(ListData), nullptr);
+	}
+	g_object_unref(FilteredModel); // The reference from the constructor or AttachModel
+}
+
+void List::AttachModel(int Selection)
+{
+	GtkTreeModel *FilteredModel = gtk_tree_model_filter_new(GTK_TREE_MODEL(Store), nullptr);
+	gtk_tree_model_filter_set_visible_column(GTK_TREE_MODEL_FILTER(FilteredModel), 1);
+	if (Multiline) gtk_tree_view_set_model(GTK_TREE_VIEW(ListData), FilteredModel);
+	else gtk_combo_box_set_model(GTK_COMBO_BOX(ListData), FilteredModel);
+	if (Selection >= 0) Select(Selection);
+	g_signal_handler_unblock(G_OBJECT(ListData), ConnectionID);
+}
+
 void List::MoveUp(int Item)
 {
 	assert(Item > 0);
@@ -1225,6 +1587,231 @@ int List::GetSelection(void)
 void List::SelectCallback(GtkWidget *, List *This)
 	{ if (This->Handler) This->Handler(); }
 
+// Virtual list, a GtkTreeModel over the row count and fetch callback
+struct VirtualListModel
+{
+	GObject Parent;
+	VirtualList::RowHandler const *Fetch; // Null once the VirtualList is gone
+	gint Count;
+	gint Stamp; // Changes with the count, invalidating old iterators
+};
+
+struct VirtualListModelClass { GObjectClass Parent; };
+
+static VirtualListModel *AsVirtualListModel(GtkTreeModel *Model)
+	{ return reinterpret_cast<VirtualListModel *>(Model); }
+
+static gboolean SetVirtualListIterator(GtkTreeModel *Model, GtkTreeIter *Iterator, gint Row)
+{
+	if ((Row < 0) || (Row >= AsVirtualListModel(Model)->Count)) return false;
+	Iterator->stamp = AsVirtualListModel(Model)->Stamp;
+	Iterator->user_data = GINT_TO_POINTER(Row);
+	return true;
+}
+
+static gint GetVirtualListRow(GtkTreeIter *Iterator)
+	{ return GPOINTER_TO_INT(Iterator->user_data); }
+
+static bool IsVirtualListIteratorValid(GtkTreeModel *Model, GtkTreeIter *Iterator)
+{
+	return (Iterator->stamp == AsVirtualListModel(Model)->Stamp) &&
+		(GetVirtualListRow(Iterator) < AsVirtualListModel(Model)->Count);
+}
+
+static GtkTreeModelFlags VirtualListGetFlags(GtkTreeModel *)
+	{ return GTK_TREE_MODEL_LIST_ONLY; } // Iterators don't persist across SetCount
+
+static gint VirtualListGetColumnCount(GtkTreeModel *)
+	{ return 1; }
+
+static GType VirtualListGetColumnType(GtkTreeModel *, gint)
+	{ return G_TYPE_STRING; }
+
+static gboolean VirtualListGetIterator(GtkTreeModel *Model, GtkTreeIter *Iterator, GtkTreePath *Path)
+{
+	if (gtk_tree_path_get_depth(Path) != 1) return false;
+	return SetVirtualListIterator(Model, Iterator, gtk_tree_path_get_indices(Path)[0]);
+}
+
+static GtkTreePath *VirtualListGetPath(GtkTreeModel *Model, GtkTreeIter *Iterator)
+{
+	if (!IsVirtualListIteratorValid(Model, Iterator)) return nullptr;
+	return gtk_tree_path_new_from_indices(GetVirtualListRow(Iterator), -1);
+}
+
+static void VirtualListGetValue(GtkTreeModel *Model, GtkTreeIter *Iterator, gint, GValue *Value)
+{
+	g_value_init(Value, G_TYPE_STRING);
+	if (!IsVirtualListIteratorValid(Model, Iterator)) return;
+	VirtualList::RowHandler const *Fetch = AsVirtualListModel(Model)->Fetch;
+	if (Fetch != nullptr) g_value_set_string(Value, (*Fetch)(GetVirtualListRow(Iterator)).c_str());
+}
+
+static gboolean VirtualListNext(GtkTreeModel *Model, GtkTreeIter *Iterator)
+{
+	if (!IsVirtualListIteratorValid(Model, Iterator)) return false;
+	return SetVirtualListIterator(Model, Iterator, GetVirtualListRow(Iterator) + 1);
+}
+
+static gboolean VirtualListGetChildren(GtkTreeModel *Model, GtkTreeIter *Iterator, GtkTreeIter *Parent)
+	{ return (Parent == nullptr) && SetVirtualListIterator(Model, Iterator, 0); }
+
+static gboolean VirtualListHasChildren(GtkTreeModel *, GtkTreeIter *)
+	{ return false; }
+
+static gint VirtualListCountChildren(GtkTreeModel *Model, GtkTreeIter *Iterator)
+	{ return (Iterator == nullptr) ? AsVirtualListModel(Model)->Count : 0; }
+
+static gboolean VirtualListGetChild(GtkTreeModel *Model, GtkTreeIter *Iterator, GtkTreeIter *Parent, gint Row)
+	{ return (Parent == nullptr) && SetVirtualListIterator(Model, Iterator, Row); }
+
+static gboolean VirtualListGetParent(GtkTreeModel *, GtkTreeIter *, GtkTreeIter *)
+	{ return false; }
+
+static void InitializeVirtualListModel(GtkTreeModelIface *Interface)
+{
+	Interface->get_flags = VirtualListGetFlags;
+	Interface->get_n_columns = VirtualListGetColumnCount;
+	Interface->get_column_type = VirtualListGetColumnType;
+	Interface->get_iter = VirtualListGetIterator;
+	Interface->get_path = VirtualListGetPath;
+	Interface->get_value = VirtualListGetValue;
+	Interface->iter_next = VirtualListNext;
+	Interface->iter_children = VirtualListGetChildren;
+	Interface->iter_has_child = VirtualListHasChildren;
+	Interface->iter_n_children = VirtualListCountChildren;
+	Interface->iter_nth_child = VirtualListGetChild;
+	Interface->iter_parent = VirtualListGetParent;
+}
+
+static GType VirtualListModelType(void)
+{
+	static GType Type = 0;
+	if (Type == 0)
+	{
+		static GTypeInfo const Information = {sizeof(VirtualListModelClass), nullptr, nullptr, nullptr, nullptr, nullptr,
+			sizeof(VirtualListModel), 0, nullptr, nullptr};
+		Type = g_type_register_static(G_TYPE_OBJECT, "RenVirtualListModel", &Information, (GTypeFlags)0);
+		static GInterfaceInfo const ModelInformation = {(GInterfaceInitFunc)InitializeVirtualListModel, nullptr, nullptr};
+		g_type_add_interface_static(Type, GTK_TYPE_TREE_MODEL, &ModelInformation);
+	}
+	return Type;
+}
+
+VirtualList::VirtualList(String const &Prompt, RowHandler const &Fetch) : 
+	Widget(gtk_tree_view_new()),
+	Fetch(Fetch),
+	Rows(static_cast<VirtualListModel *>(g_object_new(VirtualListModelType(), nullptr)))
+{
+	Rows->Fetch = &this->Fetch;
+	Rows->Count = 0;
+	Rows->Stamp = g_random_int();
+
+	// Fixed heights keep the view from fetching every row to measure it
+	GtkTreeViewColumn *Column = gtk_tree_view_column_new_with_attributes(
+		Prompt.c_str(), gtk_cell_renderer_text_new(), "text", 0, nullptr);
+	gtk_tree_view_column_set_sizing(Column, GTK_TREE_VIEW_COLUMN_FIXED);
+	gtk_tree_view_column_set_expand(Column, true);
+	gtk_tree_view_append_column(GTK_TREE_VIEW(Data), Column);
+	gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(Data), true);
+	gtk_tree_view_set_model(GTK_TREE_VIEW(Data), GTK_TREE_MODEL(Rows));
+	ConnectionID = g_signal_connect(G_OBJECT(Data), "cursor-changed", G_CALLBACK(SelectCallback), this);
+}
+
+VirtualList::~VirtualList(void)
+{
+	Rows->Fetch = nullptr; // The view may outlive us
+	if (Destroy) g_signal_handler_disconnect(G_OBJECT(Data), ConnectionID);
+	g_object_unref(Rows);
+}
+
+void VirtualList::SetInputHandler(InputHandler const &Handler)
+{
+	assert(!this->Handler);
+	this->Handler = Handler;
+}
+
+void VirtualList::SetCount(unsigned int Count)
+{
+	// Rows only change at the end, so iterators for the rest stay valid and the view keeps its state
+	gint const NewCount = Count, MaximumSignals = 1000;
+	if (abs(NewCount - Rows->Count) <= MaximumSignals)
+	{
+		while (Rows->Count < NewCount)
+		{
+			GtkTreeIter Iterator;
+			SetVirtualListIterator(GTK_TREE_MODEL(Rows), &Iterator, Rows->Count++);
+			GtkTreePath *Path = gtk_tree_path_new_from_indices(Rows->Count - 1, -1);
+			gtk_tree_model_row_inserted(GTK_TREE_MODEL(Rows), Path, &Iterator);
+			gtk_tree_path_free(Path);
+		}
+		while (Rows->Count > NewCount)
+		{
+			GtkTreePath *Path = gtk_tree_path_new_from_indices(--Rows->Count, -1);
+			gtk_tree_model_row_deleted(GTK_TREE_MODEL(Rows), Path);
+			gtk_tree_path_free(Path);
+		}
+		return;
+	}
+
+	// Detaching skips a signal per row, but loses the scroll position and cursor, so they're put back
+	int const Selection = GetSelection();
+	GtkTreePath *Top = nullptr;
+	gtk_tree_view_get_visible_range(GTK_TREE_VIEW(Data), &Top, nullptr);
+
+	g_signal_handler_block(G_OBJECT(Data), ConnectionID);
+	gtk_tree_view_set_model(GTK_TREE_VIEW(Data), nullptr);
+	Rows->Count = NewCount;
+	++Rows->Stamp;
+	gtk_tree_view_set_model(GTK_TREE_VIEW(Data), GTK_TREE_MODEL(Rows));
+	if ((Selection >= 0) && (Selection < NewCount)) Select(Selection);
+	if ((Top != nullptr) && (gtk_tree_path_get_indices(Top)[0] < NewCount))
+		gtk_tree_view_scroll_to_cell(GTK_TREE_VIEW(Data), Top, nullptr, true, 0, 0);
+	g_signal_handler_unblock(G_OBJECT(Data), ConnectionID);
+
+	if (Top != nullptr) gtk_tree_path_free(Top);
+	if ((Selection >= NewCount) && Handler) Handler(); // The selected row is gone
+}
+
+unsigned int VirtualList::Size(void)
+	{ return Rows->Count; }
+
+void VirtualList::Refresh(unsigned int Row)
+{
+	GtkTreeIter Iterator;
+	if (!SetVirtualListIterator(GTK_TREE_MODEL(Rows), &Iterator, Row)) return;
+	GtkTreePath *Path = gtk_tree_path_new_from_indices(Row, -1);
+	gtk_tree_model_row_changed(GTK_TREE_MODEL(Rows), Path, &Iterator);
+	gtk_tree_path_free(Path);
+}
+
+void VirtualList::Select(int NewSelection)
+{
+	if (NewSelection < 0)
+	{
+		gtk_tree_selection_unselect_all(gtk_tree_view_get_selection(GTK_TREE_VIEW(Data)));
+		return;
+	}
+
+	assert(NewSelection < Rows->Count);
+	GtkTreePath *NewPath = gtk_tree_path_new_from_indices(NewSelection, -1);
+	gtk_tree_view_set_cursor(GTK_TREE_VIEW(Data), NewPath, nullptr, false);
+	gtk_tree_path_free(NewPath);
+}
+
+int VirtualList::GetSelection(void)
+{
+	GtkTreePath *Path;
+	gtk_tree_view_get_cursor(GTK_TREE_VIEW(Data), &Path, nullptr);
+	if (Path == nullptr) return -1;
+	int Out = gtk_tree_path_get_indices(Path)[0];
+	gtk_tree_path_free(Path);
+	return Out;
+}
+
+void VirtualList::SelectCallback(GtkWidget *, VirtualList *This)
+	{ if (This->Handler) This->Handler(); }
+
 // Toolbar as a menu button
 MenuButton::MenuButton(const String &Label, DefaultIcons Icon) : Button(Label, Icon)
 {
@@ -1381,7 +1968,10 @@ Toolbox::Toolbox(void) : Widget(nullptr), IDCounter(0)
 }
 
 Toolbox::~Toolbox(void)
-	{ if (Destroy) g_signal_handler_disconnect(G_OBJECT(Data), ConnectionID); }
+{ 
+	CancelRequests();
+	if (Destroy) g_signal_handler_disconnect(G_OBJECT(Data), ConnectionID); 
+}
 
 void Toolbox::ForceColumns(int ColumnCount)
 	{ gtk_icon_view_set_columns(GTK_ICON_VIEW(Data), ColumnCount); }
@@ -1391,23 +1981,41 @@ int Toolbox::AddItem(const String &Image, const String &Text)
 	GtkTreeIter NewIterator;
 	gtk_list_store_append(GTK_LIST_STORE(Model), &NewIterator);
 
-	GdkPixbuf *NewPixbuf = nullptr;
-	if (!Image.empty())
-	{
-		GError *PixbufError = nullptr;
-		NewPixbuf = gdk_pixbuf_new_from_file(Image.c_str(), &PixbufError);
-		if (NewPixbuf == nullptr)
-			g_print("Error loading toolbox image %s: %s\n",
-				Image.c_str(), PixbufError->message);
-	}
-	if (NewPixbuf == nullptr) NewPixbuf = gtk_widget_render_icon(Data,
+	GdkPixbuf *Placeholder = gtk_widget_render_icon(Data,
 		GTK_STOCK_MISSING_IMAGE, GTK_ICON_SIZE_SMALL_TOOLBAR, nullptr);
-
 	gtk_list_store_set(Model, &NewIterator,
 		0, Text.c_str(),
-		1, NewPixbuf,
+		1, Placeholder,
 		2, IDCounter++,
 		-1);
+	g_object_unref(Placeholder);
+
+	if (!Image.empty())
+	{
+		// The reference follows the row if the store changes before the image arrives
+		GtkTreePath *Path = gtk_tree_model_get_path(GTK_TREE_MODEL(Model), &NewIterator);
+		std::shared_ptr<GtkTreeRowReference> Row(
+			gtk_tree_row_reference_new(GTK_TREE_MODEL(Model), Path), gtk_tree_row_reference_free);
+		gtk_tree_path_free(Path);
+		auto Request = std::make_shared<ImageLoader::RequestID>();
+		*Request = ImageLoader::Instance().Load(Image, [this, Request, Row, Image](GdkPixbuf *Decoded)
+		{
+			Requests.erase(*Request);
+			if (Decoded == nullptr)
+			{
+				g_print("Error loading toolbox image %s\n", Image.c_str());
+				return;
+			}
+			if (!gtk_tree_row_reference_valid(Row.get())) return;
+			GtkTreeModel *Model = gtk_tree_row_reference_get_model(Row.get());
+			GtkTreePath *Path = gtk_tree_row_reference_get_path(Row.get());
+			GtkTreeIter Iterator;
+			if (gtk_tree_model_get_iter(Model, &Iterator, Path))
+				gtk_list_store_set(GTK_LIST_STORE(Model), &Iterator, 1, Decoded, -1);
+			gtk_tree_path_free(Path);
+		});
+		Requests.insert(*Request);
+	}
 
 	return IDCounter - 1;
 }
@@ -1436,7 +2044,17 @@ void Toolbox::Unselect(void)
 	{ gtk_icon_view_unselect_all(GTK_ICON_VIEW(Data)); }
 
 void Toolbox::Clear(void)
-	{ gtk_list_store_clear(GTK_LIST_STORE(Model)); IDCounter = 0; }
+{ 
+	CancelRequests();
+	gtk_list_store_clear(GTK_LIST_STORE(Model)); 
+	IDCounter = 0; 
+}
+
+void Toolbox::CancelRequests(void)
+{
+	for (auto Request : Requests) ImageLoader::Instance().Cancel(Request);
+	Requests.clear();
+}
 
 void Toolbox::OnSelect(int)
 	{}
@@ -1604,7 +2222,7 @@ void ColorButton::HandleSelect(GtkWidget *, ColorButton *This)
 const FlatVector ColorToggleButtonSize(54, 48);
 ColorToggleButton::ColorToggleButton(bool InitiallyFore, const Color &ForegroundColor, const Color &BackgroundColor) : Widget(gtk_button_new()),
 	State(InitiallyFore), Foreground(ForegroundColor), Background(BackgroundColor),
-	ColorArea(gtk_drawing_area_new())
+	ColorArea(gtk_drawing_area_new()), Frames(ColorArea)
 {
 	gtk_widget_set_size_request(ColorArea, ColorToggleButtonSize[0], ColorToggleButtonSize[1]);
 	RefreshConnectionID = g_signal_connect(G_OBJECT(ColorArea), "expose_event", G_CALLBACK(RefreshCallback), this);
@@ -1629,12 +2247,7 @@ void ColorToggleButton::SetBackgroundColor(const Color &NewBackgroundColor)
 	{ Background = NewBackgroundColor; if (!State) Refresh(); }
 
 void ColorToggleButton::Refresh()
-{
-	if (!GDK_IS_WINDOW(ColorArea->window)) return;
-	const GdkRectangle RefreshRectangle = {0, 0, ColorArea->allocation.width, ColorArea->allocation.height};
-	gdk_window_invalidate_rect(ColorArea->window, &RefreshRectangle, false);
-	gdk_window_process_updates(ColorArea->window, false);
-}
+	{ Frames.Invalidate(); }
 
 gboolean ColorToggleButton::RefreshCallback(GtkWidget *, GdkEventExpose *Event, ColorToggleButton *This)
 {
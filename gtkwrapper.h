@@ -8,8 +8,15 @@
 
 #include <gtk/gtk.h>
 #include <vector>
+#include <deque>
 #include <utility>
 #include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <set>
+#include <memory>
 
 enum DefaultIcons
 {
@@ -109,6 +116,81 @@ class TimedEvent
 		int TimerID;
 };
 
+// Gathers invalidations for a widget into one damage region and redraws it once per frame, no more often
+// than the maximum rate.
+class FrameScheduler
+{
+	public:
+		FrameScheduler(GtkWidget *Data, float MaximumRate = 60);
+		~FrameScheduler(void);
+
+		void SetMaximumRate(float FramesPerSecond); // 0 for no limit
+		gint64 GetPeriod(void) const; // Microseconds
+
+		void Invalidate(void);
+		void Invalidate(GdkRectangle const &Area);
+		void Flush(void); // Redraws any pending damage immediately
+
+	private:
+		void Schedule(void);
+		static gboolean FrameHandler(FrameScheduler *This);
+
+		GtkWidget *Data;
+		GdkRegion *Damage;
+
+		gint64 Period, LastFrame; // Microseconds
+		guint TimerID;
+};
+
+// A fixed set of threads running queued jobs.  Jobs must not call GTK.
+class WorkerPool
+{
+	public:
+		WorkerPool(unsigned int ThreadCount = 0); // 0 for one per core
+		~WorkerPool(void);
+
+		static WorkerPool &Shared(void);
+
+		unsigned int GetThreadCount(void) const;
+
+		void Add(ActionHandler const &Job);
+		void Run(std::vector<ActionHandler> const &Jobs); // Blocks until all of these jobs have finished
+
+	private:
+		void Work(void);
+
+		std::vector<std::thread> Threads;
+		std::mutex Mutex;
+		std::condition_variable Wake, Finished;
+		std::deque<ActionHandler> Jobs;
+		bool Quit;
+};
+
+// Decodes images on its own threads so the GTK thread never waits on files.  Finished requests are
+// delivered on the GTK thread from the main loop; cancelled ones never are.
+class ImageLoader
+{
+	public:
+		typedef unsigned int RequestID;
+
+		static ImageLoader &Instance(void);
+
+		// Runs Work on a decoder thread, then Done on the GTK thread
+		RequestID Queue(ActionHandler const &Work, ActionHandler const &Done);
+		// Handler gets the image, or nullptr if it couldn't be loaded; it holds no reference after returning
+		RequestID Load(String const &Filename, std::function<void(GdkPixbuf *Image)> const &Handler);
+		void Cancel(RequestID Request);
+
+	private:
+		ImageLoader(void);
+		static gboolean Deliver(gpointer Data);
+
+		std::mutex Mutex;
+		std::map<RequestID, ActionHandler> Pending;
+		RequestID NextID;
+		WorkerPool Decoders; // Separate from the shared pool so decodes don't hold up tiles
+};
+
 ////////////////////////////////////////////////////////////////
 // Widget extensions
 class KeyboardWidget
@@ -334,8 +416,15 @@ class CanvasScroller : public Widget
 {
 	public:
 		CanvasScroller(void);
+		// Virtual canvas mode: the child stays the size of the view and isn't moved by scrolling.  The
+		// scroll range comes from SetLogicalSize and the position is sent to the offset handler, which
+		// should translate drawing by it (see VectorArea::SetOffset).
+		explicit CanvasScroller(bool Virtual);
 
 		void Set(GtkWidget *Settee);
+		void SetLogicalSize(FlatVector const &Size);
+		void SetOffsetHandler(std::function<void(FlatVector const &Offset)> const &Handler);
+		FlatVector GetOffset(void) const;
 
 		void ShowRange(FlatVector Start, FlatVector End);
 		void GoTo(FlatVector Position);
@@ -347,6 +436,12 @@ class CanvasScroller : public Widget
 		void SetAdjustments(int NewX, int NewY);
 		void DoInitialAdjustment(void);
 		static void InitialStateChangeHandler(void *, CanvasScroller *This);
+		static void ScrollHandler(GtkAdjustment *, CanvasScroller *This);
+		static void ViewResizeHandler(GtkWidget *, GtkAllocation *Allocation, CanvasScroller *This);
+		static gboolean WheelHandler(GtkWidget *, GdkEventScroll *Event, CanvasScroller *This);
+		
+		bool const Virtual;
+		std::function<void(FlatVector const &Offset)> OffsetHandler;
 		
 		bool InitialAdjustmentCompleted;
 		std::function<void(void)> InitialAdjustmentFunction;
@@ -411,7 +506,9 @@ class BlockLabel : public Widget
 class Sticker : public Widget
 {
 	public:
-		Sticker(const String &Filename);
+		Sticker(const String &Filename); // Shows a placeholder until the image is decoded
+	private:
+		static void CancelHandler(GtkWidget *, gpointer Request);
 };
 
 class Article : public Widget
@@ -559,6 +656,11 @@ class List : public Widget
 		int Add(const String &NewString);
 		int Add(const String &NewString, int Position);
 		void Remove(int Item);
+
+		// Bulk changes, with the view detached meanwhile.  The selection follows its row.
+		int Add(std::vector<String> const &NewStrings); // Appends, returning the index of the first
+		void Remove(std::vector<int> Items);
+		void Reorder(std::vector<int> const &NewOrder); // NewOrder[New position] = old position
 		void MoveUp(int Item);
 		void MoveDown(int Item);
 		void Rename(int Item, const String &NewString);
@@ -575,6 +677,9 @@ class List : public Widget
 		static void SelectCallback(GtkWidget *, List *This);
 		gulong ConnectionID;
 
+		void DetachModel(void);
+		void AttachModel(int Selection);
+
 		bool Multiline;
 
 		int Added;
@@ -582,6 +687,37 @@ class List : public Widget
 		GtkListStore *Store;
 };
 
+struct VirtualListModel;
+
+// A single column list whose rows are produced on demand, for row counts too large to copy into a List.
+// The view asks Fetch only for the rows it displays.  Changing the count drops the selection.
+class VirtualList : public Widget
+{
+	public:
+		typedef std::function<String(unsigned int Row)> RowHandler;
+
+		VirtualList(String const &Prompt, RowHandler const &Fetch);
+		~VirtualList(void);
+
+		void SetInputHandler(InputHandler const &Handler);
+
+		void SetCount(unsigned int Count);
+		unsigned int Size(void);
+		void Refresh(unsigned int Row); // Fetches Row again if it's displayed
+
+		void Select(int NewSelection);
+		void Deselect(void) { Select(-1); }
+		int GetSelection(void);
+	private:
+		RowHandler Fetch;
+		InputHandler Handler;
+
+		static void SelectCallback(GtkWidget *, VirtualList *This);
+		gulong ConnectionID;
+
+		VirtualListModel *Rows;
+};
+
 class MenuButton : public Button
 {
 	public:
@@ -658,7 +794,7 @@ class Toolbox : public Widget
 
 		void ForceColumns(int ColumnCount);
 
-		int AddItem(const String &Image, const String &Text);
+		int AddItem(const String &Image, const String &Text); // The image is decoded in the background
 		int GetSelected(void);
 
 		void Unselect(void);
@@ -673,6 +809,8 @@ class Toolbox : public Widget
 		gulong ConnectionID;
 
 		int IDCounter;
+		std::set<ImageLoader::RequestID> Requests; // Not yet delivered
+		void CancelRequests(void);
 
 		GtkListStore *Model;
 };
@@ -755,6 +893,7 @@ class ColorToggleButton : public Widget
 		bool State;
 		Color Foreground, Background;
 		GtkWidget *ColorArea;
+		FrameScheduler Frames;
 
 		gulong RefreshConnectionID, ClickConnectionID;
 };